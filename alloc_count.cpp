@@ -0,0 +1,40 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "alloc_count.h"
+
+// A translation unit of its own, so a new inlined into its caller is never
+// seen paired with the free below.
+
+thread_local bool count_allocations = false;
+
+namespace
+{
+
+std::atomic<long> allocations{0};
+
+}
+
+long allocations_counted()
+{
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size)
+{
+    if (count_allocations) allocations.fetch_add(1, std::memory_order_relaxed);
+    
+    if (auto p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
@@ -0,0 +1,13 @@
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+// Heap allocation counting for the benchmarks and tests. Linking
+// alloc_count.cpp replaces the global operator new; allocations are
+// counted on the threads that set count_allocations.
+
+extern thread_local bool count_allocations;
+
+// allocations counted so far, over all threads
+long allocations_counted();
+
+#endif
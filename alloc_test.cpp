@@ -0,0 +1,206 @@
+// Steady state heap allocations of the sessions, counted on the threads
+// that run them. A directory session answers pipelined lookups, the
+// sessions of a hosted room read messages from one participant and write
+// them to two; after a warm up neither may allocate for another request
+// or message.
+// Exits non-zero and says which one did otherwise.
+// Usage: chat-alloc-test
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "alloc_count.h"
+#include "chat_client.h"
+#include "chat_log.h"
+#include "chat_server.h"
+
+namespace
+{
+
+const int depth = 16;           // requests or messages in flight
+const int warm_rounds = 200;
+const int rounds = 500;
+
+// Runs `io` on a thread of its own, counting there if `counted`.
+class runner
+{
+public:
+    runner(boost::asio::io_service& io, bool counted) :
+        io_(io),
+        work_(io),
+        thread_([this, counted]() { count_allocations = counted; io_.run(); })
+    {}
+    
+    ~runner()
+    {
+        io_.stop();
+        thread_.join();
+    }
+
+private:
+    boost::asio::io_service& io_;
+    boost::asio::io_service::work work_;
+    std::thread thread_;
+};
+
+bool read_lines(tcp::socket& socket, boost::asio::streambuf& in, int n)
+{
+    boost::system::error_code ec;
+    for (int i = 0; i < n && !ec; ++i)
+    {
+        in.consume(boost::asio::read_until(socket, in, '\n', ec));
+    }
+    
+    return !ec;
+}
+
+bool report(const char* what, long allocated, long count)
+{
+    std::cerr << what << ": " << allocated << " allocations in " << count << std::endl;
+    return allocated == 0;
+}
+
+// Lookups of a registered room, `depth` to a write.
+bool directory_lookups()
+{
+    room_registry directory;
+    server_metrics metrics;
+    boost::asio::io_service io;
+    chat_server server(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), directory, metrics);
+    runner run(io, true);
+    
+    boost::asio::io_service cio;
+    tcp::socket host(cio), client(cio);
+    host.connect(server.local_endpoint());
+    client.connect(server.local_endpoint());
+    
+    std::string request;
+    boost::asio::streambuf in;
+    encode_connection_req(connect_req{"h", "room", {"127.0.0.1", 1}}, request);
+    request.push_back('\n');
+    boost::asio::write(host, boost::asio::buffer(request));
+    if (!read_lines(host, in, 1))
+    {
+        return false;
+    }
+    
+    std::string batch;
+    encode_connection_req(connect_req{"c", "room", {"127.0.0.1", 2}}, request);
+    for (int i = 0; i < depth; ++i)
+    {
+        batch += request;
+        batch.push_back('\n');
+    }
+    
+    long before = 0;
+    for (int round = 0; round < warm_rounds + rounds; ++round)
+    {
+        if (round == warm_rounds) before = allocations_counted();
+        
+        boost::asio::write(client, boost::asio::buffer(batch));
+        if (!read_lines(client, in, depth))
+        {
+            return false;
+        }
+    }
+    
+    return report("directory lookups", allocations_counted() - before, long(rounds) * depth);
+}
+
+class quiet_output : public chat_output
+{
+public:
+    void message(boost::string_view, boost::string_view) override {}
+    void message(boost::string_view, const segment_chain&, std::size_t) override {}
+    void event(peer_event, const std::string&) override {}
+};
+
+// A hosted room's session for the next connection on `acceptor`.
+void accept_session(tcp::acceptor& acceptor, chat_room& room, chat_output& output)
+{
+    session_socket socket(room.session_strand());
+    acceptor.accept(socket);
+    
+    // the echo goes out in two writes, the second would wait for the
+    // test's delayed ack
+    socket.set_option(tcp::no_delay(true));
+    std::make_shared<chat_session>(std::move(socket), "host", room, output)->start();
+}
+
+// One participant sends, both it and a second one get every message.
+bool room_messages()
+{
+    boost::asio::io_service io;
+    chat_room room(io);
+    room.hosting();
+    quiet_output output;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    runner run(io, true);
+    
+    tcp::socket sender(io), listener(io);
+    sender.connect(acceptor.local_endpoint());
+    accept_session(acceptor, room, output);
+    listener.connect(acceptor.local_endpoint());
+    accept_session(acceptor, room, output);
+    
+    std::string join_frame;
+    encode_control(join{"listener", {"127.0.0.1", 1}, 0}, wire_format::text, join_frame);
+    boost::asio::write(listener, boost::asio::buffer(join_frame));
+    
+    // enlisted once it joined, so it gets every message from here on
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (room.successors().empty() && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    
+    if (room.successors().empty())
+    {
+        std::cerr << "room messages: the listener never joined" << std::endl;
+        room.close();
+        return false;
+    }
+    
+    chat_frame frame;
+    encode_chat_message(message{"sender", std::string(100, 'x'), 0, boost::none}, frame);
+    std::string batch;
+    for (int i = 0; i < depth; ++i)
+    {
+        batch.append(boost::string_view(frame.small).data(), boost::string_view(frame.small).size());
+        batch.push_back('\n');
+    }
+    
+    // the sender gets its messages back numbered, as the listener does
+    boost::asio::streambuf sender_in, listener_in;
+    long before = 0;
+    bool ok = true;
+    
+    for (int round = 0; ok && round < warm_rounds + rounds; ++round)
+    {
+        if (round == warm_rounds) before = allocations_counted();
+        
+        boost::asio::write(sender, boost::asio::buffer(batch));
+        ok = read_lines(sender, sender_in, depth) && read_lines(listener, listener_in, depth);
+    }
+    
+    long allocated = allocations_counted() - before;
+    
+    room.close();
+    return ok && report("room messages", allocated, long(rounds) * depth);
+}
+
+}
+
+int main()
+{
+    set_log_level(log_level::none);
+    
+    bool ok = directory_lookups();
+    ok = room_messages() && ok;
+    
+    std::cerr << (ok ? "passed" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#ifndef CACHE_ALIGNED_H
+#define CACHE_ALIGNED_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+
+// Heap objects of types padded with alignas(64) against false sharing.
+// Before C++17 plain new only guarantees the alignment of max_align_t,
+// so they are placed in posix_memalign memory instead.
+
+template <typename T>
+struct aligned_delete
+{
+    std::size_t count;
+    
+    void operator()(T* p) const
+    {
+        for (std::size_t i = count; i > 0; --i)
+        {
+            p[i - 1].~T();
+        }
+        
+        std::free(p);
+    }
+};
+
+template <typename T>
+using aligned_ptr = std::unique_ptr<T, aligned_delete<T>>;
+
+template <typename T>
+using aligned_array = std::unique_ptr<T[], aligned_delete<T>>;
+
+template <typename T>
+T* aligned_storage_for(std::size_t count)
+{
+    void* p = nullptr;
+    if (posix_memalign(&p, std::max(alignof(T), sizeof(void*)), count * sizeof(T)) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    
+    return static_cast<T*>(p);
+}
+
+template <typename T>
+aligned_array<T> make_aligned_array(std::size_t count)
+{
+    auto p = aligned_storage_for<T>(count);
+    
+    std::size_t i = 0;
+    try
+    {
+        for (; i < count; ++i)
+        {
+            new (p + i) T();
+        }
+    }
+    catch (...)
+    {
+        aligned_delete<T>{i}(p);
+        throw;
+    }
+    
+    return aligned_array<T>(p, aligned_delete<T>{count});
+}
+
+template <typename T, typename... Args>
+aligned_ptr<T> make_aligned(Args&&... args)
+{
+    auto p = aligned_storage_for<T>(1);
+    
+    try
+    {
+        new (p) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        std::free(p);
+        throw;
+    }
+    
+    return aligned_ptr<T>(p, aligned_delete<T>{1});
+}
+
+#endif
@@ -0,0 +1,188 @@
+
+// Codec micro benchmarks: encode and decode cost of every PDU in both wire
+// formats, with the view decoders next to the Spirit ones. Prints one CSV
+// row per measurement so runs can be diffed and plotted across releases.
+// Usage: chat-bench [<iterations>]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "alloc_count.h"
+#include "chat_structures.h"
+#include "chat_binary.h"
+
+namespace
+{
+
+struct measurement
+{
+    double ns;
+    double allocs;
+};
+
+template <typename F>
+measurement measure(long iterations, F f)
+{
+    // warm up caches and let reused buffers reach their final capacity
+    for (long i = 0; i < iterations / 10 + 1; ++i)
+    {
+        f();
+    }
+    
+    long ok = 0;
+    long before = allocations_counted();
+    
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i)
+    {
+        ok += f();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    
+    if (ok != iterations)
+    {
+        return measurement{-1, -1};
+    }
+    
+    return measurement{
+        std::chrono::duration<double, std::nano>(elapsed).count() / iterations,
+        double(allocations_counted() - before) / iterations};
+}
+
+long iterations = 100000;
+
+void row(const char* pdu, const char* format, const char* op, std::size_t size, measurement m)
+{
+    if (m.ns < 0)
+    {
+        std::fprintf(stderr, "%s/%s/%s/%zu failed\n", pdu, format, op, size);
+        return;
+    }
+    
+    std::printf("%s,%s,%s,%zu,%.1f,%.2f\n", pdu, format, op, size, m.ns, m.allocs);
+}
+
+// Runs the text encoder/decoder pair given and the binary codec for `msg`.
+// `size` is the encoded text size, or the message body size for messages.
+template <typename T, typename Encode, typename Decode>
+void bench(const char* pdu, std::size_t size, const T& msg, Encode encode_text, Decode decode_text)
+{
+    std::string text;
+    if (!encode_text(msg, text))
+    {
+        std::fprintf(stderr, "%s/%zu does not fit the text format\n", pdu, size);
+    }
+    else
+    {
+        T out;
+        row(pdu, "text", "encode", size, measure(iterations, [&]() { text.clear(); return encode_text(msg, text); }));
+        row(pdu, "text", "decode", size, measure(iterations, [&]() { return decode_text(text, out); }));
+    }
+    
+    std::string binary;
+    encode_binary(msg, binary);
+    
+    T out;
+    row(pdu, "binary", "encode", size, measure(iterations, [&]() { binary.clear(); return encode_binary(msg, binary); }));
+    row(pdu, "binary", "decode", size, measure(iterations, [&]() { return decode_binary(binary, out); }));
+}
+
+template <typename View, typename T, typename Encode>
+void bench_view(const char* pdu, std::size_t size, const T& msg, Encode encode_text)
+{
+    View view;
+    
+    std::string text;
+    if (encode_text(msg, text))
+    {
+        row(pdu, "text", "decode_view", size, measure(iterations, [&]() { return decode_text_view(text, view); }));
+    }
+    
+    std::string binary;
+    encode_binary(msg, binary);
+    row(pdu, "binary", "decode_view", size, measure(iterations, [&]() { return decode_binary(binary, view); }));
+}
+
+// buffer_t based text encoders, copied out so every PDU bench runs on strings.
+// buffer_t truncates silently, so a full buffer counts as a failure.
+template <typename T, bool (*Encode)(const T&, buffer_t&)>
+bool via_buffer(const T& msg, std::string& out)
+{
+    buffer_t buf;
+    if (!Encode(msg, buf) || buf.end() - buf.begin() == buffer_t::max_size) return false;
+    out.append(buf.begin(), buf.end());
+    return true;
+}
+
+}
+
+bool decode_text_view(boost::string_view frame, connect_req_view& msg) { return decode_connect_req(frame, msg); }
+bool decode_text_view(boost::string_view frame, message_view& msg) { return decode_message(frame, msg); }
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        iterations = std::max(1L, std::atol(argv[1]));
+    }
+    
+    count_allocations = true;
+    
+    std::printf("pdu,format,op,size,ns_per_op,allocs_per_op\n");
+    
+    host_info host{"192.168.100.200", 40000};
+    
+    {
+        connect_req req{"alice", "lobby", host};
+        auto encode = [](const connect_req& m, std::string& s) { return encode_connection_req(m, s); };
+        bench("connect_req", 0, req, encode, 
+            [](boost::string_view f, connect_req& m) { return decode_connect_req(f, m); });
+        bench_view<connect_req_view>("connect_req", 0, req, encode);
+    }
+    
+    for (bool found: {false, true})
+    {
+        connect_res res{0, "alice", found ? host_info_opt(host) : boost::none};
+        bench(found ? "connect_res_found" : "connect_res_created", 0, res,
+            [](const connect_res& m, std::string& s) { return encode_connection_res(m, s); },
+            [](boost::string_view f, connect_res& m) { return decode_connect_res(f, m); });
+    }
+    
+    for (std::size_t rooms: {16, 256})
+    {
+        connect_batch_req req{"bridge", {}, host};
+        connect_batch_res res{0, {}};
+        for (std::size_t i = 0; i < rooms; ++i)
+        {
+            req.rooms.push_back("room" + std::to_string(i));
+            res.rooms.push_back(room_host{req.rooms.back(), "host" + std::to_string(i), 
+                i % 2 ? host_info_opt(host) : boost::none});
+        }
+        
+        bench("connect_batch_req", rooms, req,
+            [](const connect_batch_req& m, std::string& s) { return encode_connect_batch_req(m, s); },
+            [](boost::string_view f, connect_batch_req& m) { return decode_connect_batch_req(f, m); });
+        bench("connect_batch_res", rooms, res,
+            [](const connect_batch_res& m, std::string& s) { return encode_connect_batch_res(m, s); },
+            [](boost::string_view f, connect_batch_res& m) { return decode_connect_batch_res(f, m); });
+    }
+    
+    {
+        heartbeat hb{"alice", "lobby", host};
+        bench("heartbeat", 0, hb, via_buffer<heartbeat, encode_heartbeat>,
+            [](boost::string_view f, heartbeat& m) { return decode_heartbeat(f, m); });
+    }
+    
+    for (std::size_t size: {0, 16, 64, 256, 448, 4096, 65536})
+    {
+        message msg{"alice", std::string(size, 'x'), 0, boost::none};
+        bench("message", size, msg, via_buffer<message, encode_message>,
+            [](boost::string_view f, message& m) { return decode_message(f, m); });
+        bench_view<message_view>("message", size, msg, via_buffer<message, encode_message>);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,458 @@
+
+#include "chat_binary.h"
+
+namespace
+{
+
+class writer
+{
+public:
+    writer(std::string& out, pdu_type type, std::uint32_t seq) :
+        out_(out),
+        start_(out.size())
+    {
+        u8(binary_magic);
+        u8(static_cast<std::uint8_t>(type));
+        u16(0);
+        u32(0);
+        u32(seq);
+    }
+    
+    void u8(std::uint8_t v) { out_.push_back(char(v)); }
+    void u16(std::uint16_t v) { u8(v >> 8); u8(v & 0xff); }
+    void u32(std::uint32_t v) { u16(v >> 16); u16(v & 0xffff); }
+    void u64(std::uint64_t v) { u32(v >> 32); u32(v & 0xffffffff); }
+    
+    void flags(std::uint16_t v)
+    {
+        out_[start_ + 2] = char(v >> 8);
+        out_[start_ + 3] = char(v & 0xff);
+    }
+    
+    void str8(boost::string_view s)
+    {
+        if (s.size() > 0xff) ok_ = false;
+        u8(s.size());
+        out_.append(s.data(), s.size() & 0xff);
+    }
+    
+    void str32(const std::string& s)
+    {
+        u32(s.size());
+        out_.append(s);
+    }
+    
+    void host(const host_info& h)
+    {
+        str8(h.address);
+        u16(h.port);
+    }
+    
+    void count(std::size_t n)
+    {
+        if (n > 0xffff) ok_ = false;
+        u16(n);
+    }
+    
+    // `extra` payload bytes follow separately, see encode_message_head()
+    bool finish(std::size_t extra = 0)
+    {
+        if (!ok_)
+        {
+            out_.resize(start_);
+            return false;
+        }
+        
+        auto length = out_.size() - start_ - binary_header_size + extra;
+        for (int i = 0; i < 4; ++i)
+        {
+            out_[start_ + 4 + i] = char((length >> (8 * (3 - i))) & 0xff);
+        }
+        
+        return true;
+    }
+
+private:
+    std::string& out_;
+    std::size_t start_;
+    bool ok_{true};
+};
+
+class reader
+{
+public:
+    reader(boost::string_view frame, pdu_type type) :
+        p_(reinterpret_cast<const unsigned char*>(frame.data())),
+        e_(p_ + frame.size())
+    {
+        binary_header header;
+        ok_ = decode_header(frame, header) && header.type == type 
+            && header.length + binary_header_size == frame.size();
+        seq_ = ok_ ? header.seq : 0;
+        flags_ = ok_ ? header.flags : 0;
+        p_ += binary_header_size;
+    }
+    
+    std::uint32_t seq() const { return seq_; }
+    std::uint16_t flags() const { return flags_; }
+    
+    std::uint8_t u8()
+    {
+        if (!ok_ || p_ == e_) { ok_ = false; return 0; }
+        return *p_++;
+    }
+    
+    std::uint16_t u16() { std::uint16_t v = u8() << 8; return v | u8(); }
+    std::uint32_t u32() { std::uint32_t v = std::uint32_t(u16()) << 16; return v | u16(); }
+    std::uint64_t u64() { std::uint64_t v = std::uint64_t(u32()) << 32; return v | u32(); }
+    
+    void str8(std::string& s) { bytes(s, u8()); }
+    void str32(std::string& s) { bytes(s, u32()); }
+    void str8(boost::string_view& s) { bytes(s, u8()); }
+    void str32(boost::string_view& s) { bytes(s, u32()); }
+    
+    template <typename Host>
+    void host(Host& h)
+    {
+        str8(h.address);
+        h.port = u16();
+    }
+    
+    // everything read and nothing left over
+    bool done() const { return ok_ && p_ == e_; }
+    bool ok() const { return ok_; }
+
+private:
+    const char* take(std::size_t n)
+    {
+        if (!ok_ || std::size_t(e_ - p_) < n) { ok_ = false; return nullptr; }
+        p_ += n;
+        return reinterpret_cast<const char*>(p_ - n);
+    }
+    
+    void bytes(std::string& s, std::size_t n)
+    {
+        if (auto p = take(n)) s.assign(p, n);
+    }
+    
+    void bytes(boost::string_view& s, std::size_t n)
+    {
+        if (auto p = take(n)) s = boost::string_view(p, n);
+    }
+    
+    const unsigned char* p_;
+    const unsigned char* e_;
+    std::uint32_t seq_;
+    std::uint16_t flags_;
+    bool ok_;
+};
+
+}
+
+bool decode_header(boost::string_view frame, binary_header& header)
+{
+    if (frame.size() < binary_header_size || !is_binary(frame))
+    {
+        return false;
+    }
+    
+    auto p = reinterpret_cast<const unsigned char*>(frame.data());
+    header.type = static_cast<pdu_type>(p[1]);
+    header.flags = (p[2] << 8) | p[3];
+    header.length = (std::uint32_t(p[4]) << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+    header.seq = (std::uint32_t(p[8]) << 24) | (p[9] << 16) | (p[10] << 8) | p[11];
+    
+    return true;
+}
+
+bool encode_binary(const connect_req& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::connect_req, seq);
+    w.str8(msg.from);
+    w.str8(msg.room);
+    w.host(msg.host);
+    return w.finish();
+}
+
+bool encode_binary(const connect_res& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::connect_res, seq);
+    w.u32(msg.status);
+    w.str8(msg.host_id);
+    w.u8(msg.host ? 1 : 0);
+    if (msg.host) w.host(*msg.host);
+    return w.finish();
+}
+
+bool encode_binary(const connect_batch_req& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::connect_batch_req, seq);
+    w.str8(msg.from);
+    w.count(msg.rooms.size());
+    for (auto& room: msg.rooms)
+    {
+        w.str8(room);
+    }
+    w.host(msg.host);
+    return w.finish();
+}
+
+bool encode_binary(const connect_batch_res& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::connect_batch_res, seq);
+    w.u32(msg.status);
+    w.count(msg.rooms.size());
+    for (auto& room: msg.rooms)
+    {
+        w.str8(room.room);
+        w.str8(room.host_id);
+        w.u8(room.host ? 1 : 0);
+        if (room.host) w.host(*room.host);
+    }
+    return w.finish();
+}
+
+bool encode_binary(const heartbeat& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::heartbeat, seq);
+    w.str8(msg.from);
+    w.str8(msg.room);
+    w.host(msg.host);
+    return w.finish();
+}
+
+bool encode_binary(const message& msg, std::string& buf, std::uint32_t)
+{
+    writer w(buf, pdu_type::message, msg.seq);
+    w.str8(msg.from);
+    if (msg.sent)
+    {
+        w.flags(message_sent);
+        w.u64(*msg.sent);
+    }
+    w.str32(msg.body);
+    return w.finish();
+}
+
+bool encode_binary(const join& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::join, seq);
+    w.str8(msg.from);
+    w.host(msg.host);
+    w.u32(msg.after);
+    return w.finish();
+}
+
+bool encode_binary(const standby& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::standby, seq);
+    w.str8(msg.from);
+    w.str8(msg.room);
+    w.count(msg.successors.size());
+    for (auto& s: msg.successors)
+    {
+        w.str8(s.id);
+        w.host(s.host);
+    }
+    return w.finish();
+}
+
+bool encode_binary(const redirect& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::redirect, seq);
+    w.str8(msg.from);
+    w.str8(msg.to.id);
+    w.host(msg.to.host);
+    return w.finish();
+}
+
+bool encode_binary(const subtree& msg, std::string& buf, std::uint32_t seq)
+{
+    writer w(buf, pdu_type::subtree, seq);
+    w.str8(msg.from);
+    w.u32(msg.size);
+    return w.finish();
+}
+
+bool decode_binary(boost::string_view frame, connect_req& msg)
+{
+    reader r(frame, pdu_type::connect_req);
+    r.str8(msg.from);
+    r.str8(msg.room);
+    r.host(msg.host);
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, connect_res& msg)
+{
+    reader r(frame, pdu_type::connect_res);
+    msg.status = r.u32();
+    r.str8(msg.host_id);
+    msg.host = boost::none;
+    if (r.u8())
+    {
+        msg.host = host_info();
+        r.host(*msg.host);
+    }
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, connect_batch_req& msg)
+{
+    reader r(frame, pdu_type::connect_batch_req);
+    r.str8(msg.from);
+    msg.rooms.resize(r.u16());
+    for (auto& room: msg.rooms)
+    {
+        r.str8(room);
+    }
+    r.host(msg.host);
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, connect_batch_res& msg)
+{
+    reader r(frame, pdu_type::connect_batch_res);
+    msg.status = r.u32();
+    msg.rooms.resize(r.u16());
+    for (auto& room: msg.rooms)
+    {
+        r.str8(room.room);
+        r.str8(room.host_id);
+        room.host = boost::none;
+        if (r.u8())
+        {
+            room.host = host_info();
+            r.host(*room.host);
+        }
+    }
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, heartbeat& msg)
+{
+    reader r(frame, pdu_type::heartbeat);
+    r.str8(msg.from);
+    r.str8(msg.room);
+    r.host(msg.host);
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, message& msg)
+{
+    reader r(frame, pdu_type::message);
+    r.str8(msg.from);
+    if (r.flags() & message_sent) msg.sent = r.u64();
+    r.str32(msg.body);
+    msg.seq = r.seq();
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, join& msg)
+{
+    reader r(frame, pdu_type::join);
+    r.str8(msg.from);
+    r.host(msg.host);
+    msg.after = r.u32();
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, standby& msg)
+{
+    reader r(frame, pdu_type::standby);
+    r.str8(msg.from);
+    r.str8(msg.room);
+    msg.successors.resize(r.u16());
+    for (auto& s: msg.successors)
+    {
+        r.str8(s.id);
+        r.host(s.host);
+    }
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, redirect& msg)
+{
+    reader r(frame, pdu_type::redirect);
+    r.str8(msg.from);
+    r.str8(msg.to.id);
+    r.host(msg.to.host);
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, subtree& msg)
+{
+    reader r(frame, pdu_type::subtree);
+    r.str8(msg.from);
+    msg.size = r.u32();
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, connect_req_view& msg)
+{
+    reader r(frame, pdu_type::connect_req);
+    r.str8(msg.from);
+    r.str8(msg.room);
+    r.host(msg.host);
+    return r.done();
+}
+
+bool decode_binary(boost::string_view frame, message_view& msg)
+{
+    reader r(frame, pdu_type::message);
+    r.str8(msg.from);
+    msg.sent = r.flags() & message_sent ? r.u64() : 0;
+    r.str32(msg.body);
+    msg.seq = r.seq();
+    return r.done();
+}
+
+bool encode_message_head(boost::string_view from, std::uint32_t body_size, std::string& buf,
+    std::uint32_t seq, std::uint64_t sent)
+{
+    writer w(buf, pdu_type::message, seq);
+    w.str8(from);
+    if (sent)
+    {
+        w.flags(message_sent);
+        w.u64(sent);
+    }
+    w.u32(body_size);
+    return w.finish(body_size);
+}
+
+bool decode_message_head(boost::string_view head, boost::string_view& from, std::uint32_t& body_size,
+    std::size_t& head_size, std::uint32_t& seq, std::uint64_t& sent)
+{
+    binary_header header;
+    if (!decode_header(head, header) || header.type != pdu_type::message)
+    {
+        return false;
+    }
+    
+    // the send time is there if the flag says so
+    std::size_t stamp = header.flags & message_sent ? 8 : 0;
+    
+    auto p = head.substr(binary_header_size);
+    if (p.empty() || p.size() < 1u + std::uint8_t(p[0]) + stamp + 4)
+    {
+        return false;
+    }
+    
+    from = p.substr(1, std::uint8_t(p[0]));
+    seq = header.seq;
+    
+    auto n = reinterpret_cast<const unsigned char*>(p.data()) + 1 + from.size();
+    auto be = [](const unsigned char* b, std::size_t k)
+    {
+        std::uint64_t v = 0;
+        for (std::size_t i = 0; i < k; ++i) v = (v << 8) | b[i];
+        return v;
+    };
+    
+    sent = stamp ? be(n, 8) : 0;
+    body_size = be(n + stamp, 4);
+    head_size = binary_header_size + 1 + from.size() + stamp + 4;
+    
+    return header.length == head_size - binary_header_size + body_size;
+}
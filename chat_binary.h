@@ -0,0 +1,99 @@
+
+#ifndef CHAT_BINARY_H
+#define CHAT_BINARY_H
+
+#include <cstdint>
+#include <string>
+
+#include <boost/utility/string_view.hpp>
+
+#include "chat_structures.h"
+
+// Binary form of the PDUs in chat_structures.h. Every frame starts with a
+// fixed header, integers are big-endian:
+//
+//   0  u8   binary_magic, never the first byte of a text PDU
+//   1  u8   pdu_type
+//   2  u16  flags, zero but for message_sent
+//   4  u32  payload length
+//   8  u32  sequence number, echoed in the answer to a request; for a
+//           message, its number in the room
+//
+// The payload holds the fields in declaration order: ids and addresses as
+// u8 length + bytes, message bodies as u32 length + bytes, ports as u16,
+// lists as u16 count + elements, optionals as u8 presence flag + value.
+//
+// A peer picks the format with the first frame it sends, the directory
+// answers in kind. Text stays the default and is what to use for debugging.
+
+enum class wire_format { text, binary };
+
+enum class pdu_type : std::uint8_t
+{
+    connect_req = 1,
+    connect_res,
+    connect_batch_req,
+    connect_batch_res,
+    heartbeat,
+    message,
+    join,
+    standby,
+    redirect,
+    subtree
+};
+
+// A message has the send time, u64, right after `from`.
+const std::uint16_t message_sent = 1;
+
+struct binary_header
+{
+    pdu_type type;
+    std::uint16_t flags;
+    std::uint32_t length;
+    std::uint32_t seq;
+};
+
+inline bool is_binary(boost::string_view frame)
+{
+    return !frame.empty() && static_cast<unsigned char>(frame[0]) == binary_magic;
+}
+
+bool decode_header(boost::string_view frame, binary_header& header);
+
+// Append one frame to `buf`; on failure `buf` is left unchanged.
+bool encode_binary(connect_req const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(connect_res const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(connect_batch_req const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(connect_batch_res const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(heartbeat const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(message const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(join const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(standby const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(redirect const& msg, std::string& buf, std::uint32_t seq = 0);
+bool encode_binary(subtree const& msg, std::string& buf, std::uint32_t seq = 0);
+
+bool decode_binary(boost::string_view frame, connect_req& msg);
+bool decode_binary(boost::string_view frame, connect_res& msg);
+bool decode_binary(boost::string_view frame, connect_batch_req& msg);
+bool decode_binary(boost::string_view frame, connect_batch_res& msg);
+bool decode_binary(boost::string_view frame, heartbeat& msg);
+bool decode_binary(boost::string_view frame, message& msg);
+bool decode_binary(boost::string_view frame, join& msg);
+bool decode_binary(boost::string_view frame, standby& msg);
+bool decode_binary(boost::string_view frame, redirect& msg);
+bool decode_binary(boost::string_view frame, subtree& msg);
+
+bool decode_binary(boost::string_view frame, connect_req_view& msg);
+bool decode_binary(boost::string_view frame, message_view& msg);
+
+// Large messages are built and read around their body, which can live in
+// separate buffers. The head is the frame up to where the body starts.
+bool encode_message_head(boost::string_view from, std::uint32_t body_size, std::string& buf,
+    std::uint32_t seq = 0, std::uint64_t sent = 0);
+bool decode_message_head(boost::string_view head, boost::string_view& from, std::uint32_t& body_size,
+    std::size_t& head_size, std::uint32_t& seq, std::uint64_t& sent);
+
+// Offset of the number in a binary message, see message::seq.
+const std::size_t message_seq_offset = 8;
+
+#endif
@@ -6,6 +6,8 @@
 #include <string>
 #include <iterator>
 
+#include <boost/utility/string_view.hpp>
+
 template <int N, char C = '\n'>
 struct buffer
 {
@@ -32,6 +34,8 @@ struct buffer
     int length() const { return size_ + 1; }
     std::string str() const { return std::string(begin(), end()); }
     
+    operator boost::string_view() const { return boost::string_view(data_, size_); }
+    
     void reset() 
     { 
         size_ = 0; 
@@ -71,45 +75,98 @@ struct buffer
         return os;
     }
     
-    enum status { ok, bad, intermediate };
-    status consume(const std::string& msg)
+    char data_[max_size];
+    int size_;
+};
+
+using buffer_t = buffer<512>;
+
+// Binary frames (see chat_binary.h) start with this byte and carry their
+// size in the header instead of being terminated.
+constexpr unsigned char binary_magic = 0xc5;
+constexpr std::size_t binary_header_size = 12;
+
+inline std::size_t binary_frame_size(const char* header)
+{
+    auto p = reinterpret_cast<const unsigned char*>(header) + 4;
+    return binary_header_size 
+        + ((std::size_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+// Receive side of a connection carrying back-to-back frames. Reads append
+// at tail(); next() hands out every complete frame and keeps a partial one
+// until the rest arrives. Text frames come without their terminator, binary
+// frames including their header. A frame is only valid until the following
+// call to next().
+template <int N, char C = '\n'>
+class stream_buffer
+{
+public:
+    static constexpr std::size_t capacity = N;
+    
+    char* tail() { return data_ + end_; }
+    std::size_t tail_size() const { return N - end_; }
+    
+    void commit(std::size_t bytes) { end_ += bytes; }
+    void reset() { begin_ = end_ = 0; }
+    
+    bool next(boost::string_view& frame)
     {
-        int len = msg.length();
+        auto b = data_ + begin_;
+        auto avail = end_ - begin_;
+        char* e = nullptr;
         
-        if (size_ + len > N) return bad;
-        
-        status r = intermediate;
-        if (msg.back() == C) 
+        if (avail > 0 && static_cast<unsigned char>(*b) == binary_magic)
         {
-            r = ok;
-            len--;
+            if (avail >= binary_header_size && binary_frame_size(b) <= avail)
+            {
+                e = b + binary_frame_size(b);
+                frame = boost::string_view(b, e - b);
+                begin_ += e - b;
+            }
+        }
+        else
+        {
+            e = static_cast<char*>(std::memchr(b, C, avail));
+            
+            if (e)
+            {
+                frame = boost::string_view(b, e - b);
+                begin_ = e + 1 - data_;
+            }
         }
         
-        std::memcpy(data_ + size_, msg.c_str(), len);
-        size_ += len;
-        
-        return r;
-    }
-    
-    status consume(int bytes)
-    {
-        if (size_ + bytes > N) return bad;
+        if (!e)
+        {
+            // move the partial frame to the front to make room for the rest
+            if (begin_ > 0)
+            {
+                std::memmove(data_, b, end_ - begin_);
+                end_ -= begin_;
+                begin_ = 0;
+            }
+            
+            return false;
+        }
         
-        status r = intermediate;
-        size_ += bytes;
-        if (data_[size_] == C) 
+        if (begin_ == end_)
         {
-            r = ok;
-            size_--;
+            begin_ = end_ = 0;
         }
         
-        return r;
+        return true;
     }
     
-    char data_[max_size];
-    int size_;
+    // a frame that does not fit is a protocol error
+    bool full() const { return end_ == N; }
+    
+    // what is left after next() returned false, the start of a frame
+    boost::string_view pending() const { return boost::string_view(data_ + begin_, end_ - begin_); }
+    
+private:
+    char data_[N];
+    std::size_t begin_{0};
+    std::size_t end_{0};
 };
 
-using buffer_t = buffer<512>;
-
 #endif
\ No newline at end of file
@@ -8,442 +8,1477 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
-#include <cstdlib>
-#include <deque>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <thread>
-#include <chrono>
-#include <set>
 
-#include <boost/asio.hpp>
+#include "chat_client.h"
+#include "chat_log.h"
 
-#include "chat_structures.h"
+std::size_t max_message_size = 1 << 20;
+std::size_t max_write_batch = 64 * 1024;
+std::size_t history_depth = 100;
+std::size_t standby_count = 2;
+std::size_t relay_fanout = 0;
 
-#define PRINT_DEBUG(...) //printf(__VA_ARGS__)
+queue_limits send_limits;
+queue_stats send_stats;
 
-using boost::asio::ip::tcp;
+//----------------------------------------------------------------------
 
-const unsigned short Port = 12345;
+namespace
+{
 
-//----------------------------------------------------------------------
-typedef buffer_t chat_message;
-typedef std::deque<chat_message> chat_message_queue;
+// Process wide free list of the blocks make_frame() allocates, the frame
+// and its reference count in one. Keeps at most max_free of them around.
+class frame_pool
+{
+public:
+    static constexpr std::size_t max_free = 1024;
+    
+    explicit frame_pool(std::size_t size) : size_(size) {}
+    
+    ~frame_pool()
+    {
+        while (free_)
+        {
+            auto b = free_;
+            free_ = b->next;
+            ::operator delete(b);
+        }
+    }
+    
+    void* acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            if (free_)
+            {
+                auto b = free_;
+                free_ = b->next;
+                --count_;
+                return b;
+            }
+        }
+        
+        return ::operator new(size_);
+    }
+    
+    void release(void* p)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            if (count_ < max_free)
+            {
+                auto b = static_cast<block*>(p);
+                b->next = free_;
+                free_ = b;
+                ++count_;
+                return;
+            }
+        }
+        
+        ::operator delete(p);
+    }
 
-//----------------------------------------------------------------------
+private:
+    struct block
+    {
+        block* next;
+    };
+    
+    std::size_t size_;
+    std::mutex mutex_;
+    block* free_{nullptr};
+    std::size_t count_{0};
+};
 
-class chat_participant
+template <typename T>
+class frame_allocator
 {
 public:
-  virtual ~chat_participant() {}
-  virtual void deliver(const chat_message& msg) = 0;
-  
-  std::string id;
+    typedef T value_type;
+    
+    frame_allocator() = default;
+    
+    template <typename U>
+    frame_allocator(const frame_allocator<U>&) noexcept {}
+    
+    bool operator==(const frame_allocator&) const noexcept { return true; }
+    bool operator!=(const frame_allocator&) const noexcept { return false; }
+    
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(n == 1 ? pool().acquire() : ::operator new(n * sizeof(T)));
+    }
+    
+    void deallocate(T* p, std::size_t n)
+    {
+        if (n == 1)
+        {
+            pool().release(p);
+        }
+        else
+        {
+            ::operator delete(p);
+        }
+    }
+
+private:
+    static frame_pool& pool()
+    {
+        static frame_pool pool(sizeof(T));
+        return pool;
+    }
 };
 
-typedef std::shared_ptr<chat_participant> chat_participant_ptr;
+}
+
+std::shared_ptr<chat_frame> make_frame()
+{
+    return std::allocate_shared<chat_frame>(frame_allocator<chat_frame>());
+}
+
+std::size_t frame_size(const chat_frame& msg)
+{
+    if (!msg.parts.empty())
+    {
+        std::size_t size = 0;
+        for (const auto& part: msg.parts) size += frame_size(*part);
+        return size;
+    }
+    
+    return msg.large.empty() ? msg.small.length() : msg.large.size();
+}
+
+void append_buffers(const chat_frame& msg, std::vector<boost::asio::const_buffer>& out)
+{
+    if (!msg.parts.empty())
+    {
+        for (const auto& part: msg.parts) append_buffers(*part, out);
+    }
+    else if (msg.large.empty())
+    {
+        out.emplace_back(msg.small.begin(), msg.small.length());
+    }
+    else
+    {
+        msg.large.for_each([&out](boost::string_view part) { out.emplace_back(part.data(), part.size()); });
+    }
+}
+
+bool encode_chat_message(const message& msg, chat_frame& out)
+{
+    if (!encode_message(msg, out.small))
+    {
+        return false;
+    }
+    
+    // buffer_t truncates, so a full one means the text did not fit
+    if (out.small.end() - out.small.begin() < buffer_t::max_size)
+    {
+        return true;
+    }
+    
+    std::string head;
+    if (msg.body.size() > max_message_size
+        || !encode_message_head(msg.from, msg.body.size(), head, msg.seq, msg.sent.value_or(0)))
+    {
+        return false;
+    }
+    
+    out.large.append(head);
+    out.large.append(msg.body);
+    return true;
+}
+
+std::uint64_t wall_clock_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+namespace
+{
+
+// between clocks of different hosts the difference can come out negative
+std::uint64_t since(std::uint64_t sent)
+{
+    auto now = wall_clock_us();
+    return now > sent ? now - sent : 0;
+}
+
+template <typename T, typename Encode>
+bool encode_control(const T& pdu, wire_format format, std::string& buf, Encode encode_text)
+{
+    if (format == wire_format::binary)
+    {
+        return encode_binary(pdu, buf);
+    }
+    
+    auto size = buf.size();
+    if (!encode_text(pdu, buf))
+    {
+        buf.resize(size);
+        return false;
+    }
+    
+    buf.push_back('\n');
+    return true;
+}
+
+}
+
+bool encode_control(const join& pdu, wire_format format, std::string& buf)
+{
+    return encode_control(pdu, format, buf, encode_join);
+}
+
+bool encode_control(const standby& pdu, wire_format format, std::string& buf)
+{
+    return encode_control(pdu, format, buf, encode_standby);
+}
+
+bool encode_control(const redirect& pdu, wire_format format, std::string& buf)
+{
+    return encode_control(pdu, format, buf, encode_redirect);
+}
+
+bool encode_control(const subtree& pdu, wire_format format, std::string& buf)
+{
+    return encode_control(pdu, format, buf, encode_subtree);
+}
+
+void store_frame(boost::string_view frame, chat_frame& out)
+{
+    if (!is_binary(frame) && frame.size() < buffer_t::max_size)
+    {
+        out.small = frame;
+    }
+    else
+    {
+        out.large.append(frame);
+        if (!is_binary(frame)) out.large.append("\n", 1);
+    }
+}
+
+namespace
+{
+
+// Where the digits of a fixed width text seq start in `tail`, the end of
+// a text message; npos if the sender wrote it another way. Nothing but
+// the optional sent follows seq, so its field is the last one.
+std::size_t seq_digits_at(boost::string_view tail)
+{
+    auto at = tail.rfind(",seq:");
+    if (at == boost::string_view::npos)
+    {
+        return at;
+    }
+    
+    at += 5;
+    auto digits = tail.substr(at, message_seq_digits + 1);
+    auto width = std::find_if(digits.begin(), digits.end(), [](char c) { return c < '0' || c > '9'; })
+        - digits.begin();
+    
+    return width == message_seq_digits ? at : boost::string_view::npos;
+}
+
+// Numbers a text message in place, false if its seq is not fixed width.
+bool stamp_text(chat_frame& frame, std::uint32_t seq)
+{
+    // ",seq:" with its digits, ",sent:" with 20 and "}\n" all fit
+    char tail[64];
+    
+    bool large = !frame.large.empty();
+    boost::string_view small = frame.small;
+    std::size_t size = large ? frame.large.size() : small.size();
+    std::size_t n = std::min(size, sizeof(tail));
+    std::size_t start = size - n;
+    
+    if (large)
+    {
+        frame.large.copy(start, tail, n);
+    }
+    else
+    {
+        std::memcpy(tail, small.data() + start, n);
+    }
+    
+    auto at = seq_digits_at(boost::string_view(tail, n));
+    if (at == boost::string_view::npos)
+    {
+        return false;
+    }
+    
+    char digits[message_seq_digits];
+    for (int i = message_seq_digits - 1; i >= 0; --i, seq /= 10)
+    {
+        digits[i] = char('0' + seq % 10);
+    }
+    
+    if (large)
+    {
+        return frame.large.overwrite(start + at, digits, sizeof(digits));
+    }
+    
+    std::memcpy(frame.small.data() + start + at, digits, sizeof(digits));
+    return true;
+}
+
+}
+
+// Messages are numbered in place, binary ones in their header and text
+// ones in their fixed width seq field. Text from senders that wrote seq
+// another way is encoded anew.
+bool stamp_frame(chat_frame& frame, std::uint32_t seq)
+{
+    if (!frame.large.empty() && is_binary(frame.large.front()))
+    {
+        char n[4] = { char(seq >> 24), char(seq >> 16), char(seq >> 8), char(seq) };
+        return frame.large.overwrite(message_seq_offset, n, sizeof(n));
+    }
+    
+    if (stamp_text(frame, seq))
+    {
+        return true;
+    }
+    
+    std::string text;
+    boost::string_view view = frame.small;
+    if (!frame.large.empty())
+    {
+        frame.large.for_each([&text](boost::string_view part) { text.append(part.data(), part.size()); });
+        text.pop_back();
+        view = text;
+    }
+    
+    message_view msg;
+    if (!decode_message(view, msg))
+    {
+        return false;
+    }
+    
+    message numbered{msg.from.to_string(), msg.body.to_string(), seq, boost::none};
+    if (msg.sent) numbered.sent = msg.sent;
+    
+    chat_frame out;
+    if (!encode_chat_message(numbered, out))
+    {
+        return false;
+    }
+    
+    frame = std::move(out);
+    return true;
+}
+
+bool decode_any(boost::string_view frame, message_view& msg)
+{
+    return is_binary(frame) ? decode_binary(frame, msg) : decode_message(frame, msg);
+}
+
+bool decode_any(boost::string_view frame, join& msg)
+{
+    return is_binary(frame) ? decode_binary(frame, msg) : decode_join(frame, msg);
+}
+
+bool decode_any(boost::string_view frame, standby& msg)
+{
+    return is_binary(frame) ? decode_binary(frame, msg) : decode_standby(frame, msg);
+}
+
+bool decode_any(boost::string_view frame, redirect& msg)
+{
+    return is_binary(frame) ? decode_binary(frame, msg) : decode_redirect(frame, msg);
+}
+
+bool decode_any(boost::string_view frame, subtree& msg)
+{
+    return is_binary(frame) ? decode_binary(frame, msg) : decode_subtree(frame, msg);
+}
+
+void print_body(std::ostream& os, const segment_chain& chain, std::size_t skip)
+{
+    chain.for_each([&os, &skip](boost::string_view part)
+    {
+        auto k = std::min(skip, part.size());
+        os.write(part.data() + k, part.size() - k);
+        skip -= k;
+    });
+}
+
+std::size_t gather(const chat_message_queue& queue, std::size_t cap,
+    std::vector<boost::asio::const_buffer>& out)
+{
+    out.clear();
+    
+    std::size_t bytes = 0;
+    std::size_t count = 0;
+    
+    for (const auto& msg: queue)
+    {
+        auto size = frame_size(*msg);
+        if (count > 0 && bytes + size > cap)
+        {
+            break;
+        }
+        
+        append_buffers(*msg, out);
+        
+        bytes += size;
+        ++count;
+    }
+    
+    return count;
+}
+
+//----------------------------------------------------------------------
+
+void console_output::message(boost::string_view from, boost::string_view body)
+{
+    std::cout << from << "> " << body << '\n';
+}
+
+void console_output::message(boost::string_view from, const segment_chain& frame, std::size_t skip)
+{
+    std::cout << from << "> ";
+    print_body(std::cout, frame, skip);
+    std::cout << '\n';
+}
+
+void console_output::event(peer_event e, const std::string& who)
+{
+    switch (e)
+    {
+    case peer_event::connected:
+        std::cout << "system> You are connected. " << who << " is host of the room" << std::endl;
+        break;
+    case peer_event::hosting:
+        std::cout << "system> You are now host of the room." << std::endl;
+        break;
+    case peer_event::host_left:
+        std::cout << "system> " << who << " left." << std::endl;
+        break;
+    }
+}
+
+void console_output::flush()
+{
+    std::cout.flush();
+}
+
+chat_output& console()
+{
+    static console_output output;
+    return output;
+}
 
 //----------------------------------------------------------------------
 
-class chat_room
+chat_room::chat_room(boost::asio::io_service& io, std::size_t depth) :
+    io_(io),
+    depth_(depth),
+    ring_(depth)
+{
+}
+
+chat_strand chat_room::session_strand()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto count = std::max<std::size_t>(std::thread::hardware_concurrency(), members_.size() / fanout_slice + 1);
+    while (outlets_.size() < count)
+    {
+        outlets_.emplace_back(new outlet(chat_strand(io_.get_executor()), outlets_.size()));
+    }
+    
+    next_strand_ = (next_strand_ + 1) % outlets_.size();
+    return outlets_[next_strand_]->strand;
+}
+
+participant_id chat_room::join(chat_participant_ptr participant, const chat_strand& strand, std::uint32_t after)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto index = std::find_if(outlets_.begin(), outlets_.end(),
+        [&strand](const std::unique_ptr<outlet>& o) { return o->strand == strand; }) - outlets_.begin();
+    if (std::size_t(index) == outlets_.size())
+    {
+        outlets_.emplace_back(new outlet(strand, index));
+        slices_.reset();
+    }
+    
+    participant_id slot;
+    if (free_slots_.empty())
+    {
+        slot = positions_.size();
+        positions_.push_back(0);
+    }
+    else
+    {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+    }
+    
+    positions_[slot] = members_.size();
+    members_.push_back(member{slot, participant, std::size_t(index)});
+    slices_.reset();
+    
+    // queued under the lock, so ahead of any broadcast that includes it
+    auto recent = history(after);
+    if (recent && !recent->parts.empty())
+    {
+        participant->deliver(recent);
+    }
+    
+    return slot;
+}
+
+void chat_room::leave(participant_id slot)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto pos = positions_[slot];
+    
+    members_[pos] = std::move(members_.back());
+    positions_[members_[pos].slot] = pos;
+    members_.pop_back();
+    
+    free_slots_.push_back(slot);
+    slices_.reset();
+    
+    auto it = std::find_if(candidates_.begin(), candidates_.end(),
+        [slot](const candidate& c) { return c.slot == slot; });
+    if (it != candidates_.end())
+    {
+        bool named = std::size_t(it - candidates_.begin()) < standby_count;
+        candidates_.erase(it);
+        
+        if (named)
+        {
+            succession_changed();
+        }
+    }
+    
+    load_changed();
+}
+
+void chat_room::enlist(participant_id slot, const successor& info)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    candidates_.push_back(candidate{slot, info, 1});
+    
+    // a relay's room never announces on its own, so the member gets the
+    // list it has even if it is about to change
+    if (standby_)
+    {
+        members_[positions_[slot]].participant->deliver(standby_);
+    }
+    
+    if (candidates_.size() <= standby_count)
+    {
+        succession_changed();
+    }
+    
+    load_changed();
+}
+
+std::vector<successor> chat_room::successors()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    std::vector<successor> successors;
+    for (std::size_t i = 0; i < candidates_.size() && i < standby_count; ++i)
+    {
+        successors.push_back(candidates_[i].info);
+    }
+    
+    return successors;
+}
+
+bool chat_room::place(successor& relay)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    if (relay_fanout == 0 || members_.size() < relay_fanout || candidates_.empty())
+    {
+        return false;
+    }
+    
+    auto lightest = std::min_element(candidates_.begin(), candidates_.end(),
+        [](const candidate& a, const candidate& b) { return a.load < b.load; });
+    
+    // counted ahead of its report, so a burst of joiners spreads out
+    ++lightest->load;
+    relay = lightest->info;
+    return true;
+}
+
+void chat_room::set_load(participant_id slot, std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto it = std::find_if(candidates_.begin(), candidates_.end(),
+        [slot](const candidate& c) { return c.slot == slot; });
+    if (it != candidates_.end())
+    {
+        it->load = std::max<std::size_t>(size, 1);
+        load_changed();
+    }
+}
+
+// `from` is no_participant for the host's own messages and for messages
+// from upstream. Members are split into slices by the strand their session
+// runs on and each slice is delivered from that strand, so a big room
+// fans out on every worker and a member is handed the message without
+// another hop. A member keeps its strand, and sees a sender's messages in
+// order. The sender's own strand is drained here once the lock is let go,
+// rather than posted to.
+void chat_room::deliver(const std::shared_ptr<chat_frame>& msg, participant_id from, std::uint32_t seq,
+    std::uint64_t sent)
+{
+    // a relay's subtree sees them in the host's order, and numbered
+    if (from != no_participant && !hosting_)
+    {
+        if (forward_) forward_(msg);
+        return;
+    }
+    
+    if (sent && hosting_)
+    {
+        to_host_.record(since(sent));
+    }
+    
+    outlet* here = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        // numbered and queued to the strands under the lock, so members
+        // get them in order
+        if (hosting_)
+        {
+            seq = stamp_frame(*msg, next_seq_) ? next_seq_ : 0;
+        }
+        
+        push_history(msg, seq);
+        
+        if (!slices_) build_slices();
+        
+        for (std::size_t i = 0; i < slices_->size(); ++i)
+        {
+            if ((*slices_)[i].members.empty()) continue;
+            
+            auto& out = *outlets_[i];
+            out.pending.push_back(queued{msg, slices_});
+            if (!out.scheduled)
+            {
+                out.scheduled = true;
+                if (out.strand.running_in_this_thread())
+                {
+                    here = &out;
+                }
+                else
+                {
+                    boost::asio::post(out.strand, [this, &out]() { drain(out); });
+                }
+            }
+        }
+    }
+    
+    if (here) drain(*here);
+}
+
+// On the outlet's strand. The vectors trade places, so both keep their
+// capacity.
+void chat_room::drain(outlet& out)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.draining.swap(out.pending);
+        out.scheduled = false;
+    }
+    
+    for (const auto& q: out.draining)
+    {
+        for (const auto& m: (*q.slices)[out.index].members)
+        {
+            m.participant->deliver(q.msg);
+        }
+    }
+    
+    out.draining.clear();
+}
+
+void chat_room::announce(const chat_message& msg)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    standby_ = msg;
+    for (const auto& m: members_)
+    {
+        m.participant->deliver(msg);
+    }
+}
+
+void chat_room::on_succession(succession_handler handler)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    succession_ = std::move(handler);
+}
+
+void chat_room::on_load(load_handler handler)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_load_ = std::move(handler);
+}
+
+void chat_room::on_forward(forward_handler handler)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    forward_ = std::move(handler);
+}
+
+void chat_room::hosting()
+{
+    hosting_ = true;
+}
+
+void chat_room::received(std::uint64_t sent)
+{
+    if (sent)
+    {
+        to_peer_.record(since(sent));
+    }
+}
+
+std::size_t chat_room::load()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return load_;
+}
+
+void chat_room::close()
+{
+    std::vector<member> members;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        members = members_;
+    }
+    
+    for (const auto& m: members)
+    {
+        m.participant->close();
+    }
+}
+
+// Messages after `after` as one frame, written to a joiner with a single
+// gather write. The whole history is built on the first join after a
+// message arrives and shared by everyone joining until the next one; a
+// peer that reconnects gets only what it missed. Older messages that would
+// not fit a send queue are left out.
+chat_message chat_room::history(std::uint32_t after)
+{
+    if (depth_ == 0)
+    {
+        return nullptr;
+    }
+    
+    std::uint32_t oldest = next_seq_ > depth_ ? next_seq_ - depth_ : 1;
+    bool whole = after < oldest;
+    
+    if (whole && history_)
+    {
+        return history_;
+    }
+    
+    auto batch = std::make_shared<chat_frame>();
+    std::size_t bytes = 0;
+    
+    for (auto seq = next_seq_ - 1; seq >= std::max(after + 1, oldest); --seq)
+    {
+        // a gap, when this peer was not sent everything
+        const auto& entry = ring_[seq % depth_];
+        if (entry.seq != seq) continue;
+        
+        bytes += frame_size(*entry.msg);
+        if (bytes > send_limits.bytes) break;
+        batch->parts.push_back(entry.msg);
+    }
+    
+    std::reverse(batch->parts.begin(), batch->parts.end());
+    
+    if (whole)
+    {
+        history_ = batch;
+    }
+    
+    return batch;
+}
+
+// Messages without a number are on their way up to the host from this
+// peer's subtree, and are kept by the host once it numbered them.
+void chat_room::push_history(const chat_message& msg, std::uint32_t seq)
+{
+    if (seq == 0)
+    {
+        return;
+    }
+    
+    next_seq_ = std::max(next_seq_, seq + 1);
+    
+    if (depth_ > 0)
+    {
+        ring_[seq % depth_] = numbered{seq, msg};
+        history_.reset();
+    }
+}
+
+void chat_room::succession_changed()
+{
+    if (!succession_)
+    {
+        return;
+    }
+    
+    std::vector<successor> successors;
+    for (std::size_t i = 0; i < candidates_.size() && i < standby_count; ++i)
+    {
+        successors.push_back(candidates_[i].info);
+    }
+    
+    succession_(successors);
+}
+
+// Members that never enlisted count as one peer each.
+void chat_room::load_changed()
+{
+    auto load = 1 + members_.size() - candidates_.size();
+    for (const auto& c: candidates_)
+    {
+        load += c.load;
+    }
+    
+    if (load != load_)
+    {
+        load_ = load;
+        if (on_load_) on_load_(load);
+    }
+}
+
+void chat_room::build_slices()
+{
+    auto slices = std::make_shared<std::vector<slice>>(outlets_.size());
+    
+    for (const auto& m: members_)
+    {
+        (*slices)[m.strand].members.push_back(m);
+    }
+    
+    slices_ = slices;
+}
+
+//----------------------------------------------------------------------
+
+chat_host::chat_host(boost::asio::io_service& io, const std::string& id, unsigned short port,
+    chat_output& output) :
+    io_       (io),
+    strand_   (io.get_executor()),
+    acceptor_ (strand_),
+    resolver_ (strand_),
+    id_       (id),
+    port_     (port),
+    output_   (output),
+    room_     (io)
+{
+    tcp::endpoint local(tcp::endpoint(tcp::v4(), port_));
+    
+    acceptor_.open(local.protocol());
+    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    acceptor_.bind(local);
+    acceptor_.listen();
+    
+    port_ = acceptor_.local_endpoint().port();
+}
+
+void chat_host::start_accept()
+{
+    if (accepting_)
+    {
+        return;
+    }
+    
+    accepting_ = true;
+    LOG_DEBUG("start accepting on port {}", port_);
+    do_accept();
+}
+
+void chat_host::do_accept()
+{
+    acceptor_.async_accept(room_.session_strand(),
+        [this](boost::system::error_code ec, session_socket socket)
+        {
+            if (!acceptor_.is_open())
+            {
+                return;
+            }
+            
+            if (!ec)
+            {
+                LOG_DEBUG("new user accepted");
+                std::make_shared<chat_session>(std::move(socket), id_, room_, output_)->start();
+            }
+            
+            do_accept();
+        });
+}
+
+//----------------------------------------------------------------------
+
+chat_client::chat_client(boost::asio::io_service& io_service, tcp::resolver::iterator it,
+    const std::string& room,
+    const std::string& id,
+    unsigned short port,
+    wire_format format,
+    chat_output& output
+)
+  : chat_host (io_service, id, port, output),
+    socket_     (strand_),
+    write_msgs_ (),
+    
+    remote_(it),
+    srvsocket_  (strand_),
+    heartbeat_timer_ (strand_),
+    retry_timer_ (strand_),
+    room_id_ (room),
+    format_ (format)
+{
+    // these run under the room's lock or on a session's strand, the
+    // work is done on ours
+    room_.on_succession([this](const std::vector<successor>& successors)
+        {
+            boost::asio::post(strand_, [this, successors]() { announce(successors); });
+        });
+    
+    room_.on_load([this](std::size_t size)
+        {
+            boost::asio::post(strand_, [this, size]() { report_load(size); });
+        });
+    
+    room_.on_forward([this](const chat_message& msg)
+        {
+            boost::asio::post(strand_, [this, msg]() { send_upstream(msg); });
+        });
+    
+    boost::asio::post(strand_, [this]() { do_connect_server(remote_); });
+}
+
+void chat_client::write(std::shared_ptr<chat_frame> msg)
+{
+    boost::asio::post(strand_,
+        [this, msg]()
+        {
+            if (is_host_)
+            {
+                room_.deliver(msg, no_participant);
+                return;
+            }
+            
+            // the subtree this peer relays to gets it back from upstream
+            send_upstream(msg);
+        });
+}
+
+void chat_client::close()
+{
+    boost::asio::post(strand_,
+        [this]()
+        {
+            closed_ = true;
+            
+            heartbeat_timer_.cancel();
+            retry_timer_.cancel();
+            resolver_.cancel();
+            acceptor_.close();
+            socket_.close();
+            srvsocket_.close();
+            room_.close();
+        });
+}
+
+void chat_client::do_resolve(const std::string& address, unsigned short port)
+{
+    LOG_DEBUG("resolving {}:{}", address, port);
+    tcp::resolver::query query(address, std::to_string(port));
+    resolver_.async_resolve(query,
+        [this](const boost::system::error_code& ec, tcp::resolver::iterator it)
+        {
+            if (!ec)
+            {
+                do_connect(it);
+            }
+            else
+            {
+                LOG_DEBUG("failed to resolve host address: {}", ec.message());
+                unreachable();
+            }
+        });
+}
+
+void chat_client::do_connect(tcp::resolver::iterator remote)
+{
+    LOG_DEBUG("connecting to {}", remote->host_name());
+    boost::asio::async_connect(socket_, remote,
+        [this](boost::system::error_code ec, tcp::resolver::iterator)
+        {
+            if (ec)
+            {
+                socket_.close();
+                unreachable();
+                return;
+            }
+            
+            if (closed_)
+            {
+                return;
+            }
+            
+            // a relay is only a detour to the same room
+            if (upstream_ != upstream::relay)
+            {
+                output_.event(peer_event::connected, root_.id);
+            }
+            
+            // the join goes first, then the size of the subtree this
+            // peer brings along
+            auto load = room_.load();
+            auto load_frame = std::make_shared<chat_frame>();
+            if (load > 1 && encode_control(subtree{id_, std::uint32_t(load)}, format_, *load_frame))
+            {
+                write_msgs_.push_front(load_frame);
+            }
+            
+            auto join_frame = std::make_shared<chat_frame>();
+            if (encode_control(join{id_, host_, last_seq_}, format_, *join_frame))
+            {
+                write_msgs_.push_front(join_frame);
+            }
+            
+            connected_ = true;
+            retry_delay_ = lookup_retry_first;
+            in_.reset();
+            
+            // joiners may be sent down to this peer from now on
+            start_accept();
+            
+            if (!writing_)
+            {
+                do_write();
+            }
+            do_read();
+        });
+}
+
+void chat_client::do_read()
+{
+    socket_.async_read_some(boost::asio::buffer(in_.tail(), in_.tail_size()),
+        [this](boost::system::error_code ec, std::size_t length)
+        {
+            if (ec)
+            {
+                host_lost();
+                return;
+            }
+            
+            in_.commit(length);
+            
+            boost::string_view frame;
+            while (in_.next(frame))
+            {
+                handle(frame);
+            }
+            output_.flush();
+            
+            if (redirect_)
+            {
+                auto to = *redirect_;
+                redirect_ = boost::none;
+                
+                connected_ = false;
+                socket_.close();
+                join_upstream(to, upstream::relay);
+                return;
+            }
+            
+            auto large = oversized_frame(in_);
+            
+            if (large > max_message_size || (!large && in_.full()))
+            {
+                socket_.close();
+                return;
+            }
+            
+            if (large)
+            {
+                do_read_large(large);
+            }
+            else
+            {
+                do_read();
+            }
+        });
+}
+
+void chat_client::do_read_large(std::size_t size)
 {
-public:
-  void join(chat_participant_ptr participant)
-  {
-    participants_.insert(participant);
-    for (auto msg: recent_msgs_)
-      participant->deliver(msg);
-  }
-
-  void leave(chat_participant_ptr participant)
-  {
-    participants_.erase(participant);
-  }
-
-  void deliver(const chat_message& msg, const std::string& from)
-  {
-    recent_msgs_.push_back(msg);
-    while (recent_msgs_.size() > max_recent_msgs)
-      recent_msgs_.pop_front();
-
-    for (auto participant: participants_)
-        if (participant->id != from)
-            participant->deliver(msg);
-  }
+    auto rest = in_.pending();
+    large_.clear();
+    large_.append(rest);
+    auto buffers = large_.prepare(size - rest.size());
+    in_.reset();
+    
+    boost::asio::async_read(socket_, buffers,
+        [this](boost::system::error_code ec, std::size_t length)
+        {
+            if (ec)
+            {
+                host_lost();
+                return;
+            }
+            
+            large_.commit(length);
+            
+            boost::string_view from;
+            std::uint32_t body_size;
+            std::size_t head_size;
+            std::uint32_t seq;
+            std::uint64_t sent;
+            
+            if (decode_message_head(large_.front(), from, body_size, head_size, seq, sent))
+            {
+                track_seq(seq);
+                
+                // the segments move, so `from` stays valid
+                auto out = make_frame();
+                out->large = std::move(large_);
+                if (from != id_)
+                {
+                    room_.received(sent);
+                    output_.message(from, out->large, head_size);
+                }
+                room_.deliver(out, no_participant, seq);
+            }
+            
+            large_.clear();
+            do_read();
+        });
+}
 
-private:
-  std::set<chat_participant_ptr> participants_;
-  enum { max_recent_msgs = 100 };
-  chat_message_queue recent_msgs_;
-};
+// Messages from upstream go through this peer's own room: to the subtree
+// it relays to, and into the history it replays if it takes the room over.
+void chat_client::handle(boost::string_view frame)
+{
+    message_view msg;
+    standby sb;
+    redirect to;
+    
+    if (decode_any(frame, msg))
+    {
+        track_seq(msg.seq);
+        
+        // this peer's own come back numbered, or replayed after a reconnect
+        if (msg.from != id_)
+        {
+            room_.received(msg.sent);
+            output_.message(msg.from, msg.body);
+        }
+        
+        auto out = make_frame();
+        store_frame(frame, *out);
+        room_.deliver(out, no_participant, msg.seq);
+    }
+    else if (decode_any(frame, sb))
+    {
+        successors_ = std::move(sb.successors);
+        
+        auto out = std::make_shared<chat_frame>();
+        store_frame(frame, *out);
+        room_.announce(out);
+    }
+    else if (decode_any(frame, to))
+    {
+        redirect_ = to.to;
+    }
+}
 
-//----------------------------------------------------------------------
+// Notes the number up to which every message arrived, the next join
+// resumes after it, so a gap is replayed rather than lost. The first one
+// after a fresh join is wherever the host's history starts.
+void chat_client::track_seq(std::uint32_t seq)
+{
+    if (seq != 0 && (last_seq_ == 0 || seq == last_seq_ + 1))
+    {
+        last_seq_ = seq;
+    }
+}
 
-class chat_session
-  : public chat_participant,
-    public std::enable_shared_from_this<chat_session>
+void chat_client::send_upstream(const chat_message& msg)
 {
-public:
-  chat_session(tcp::socket socket, const std::string& id, chat_room& room) : 
-      socket_(std::move(socket)),
-      room_(room)
-  {
-  }
-
-  void start()
-  {
-    room_.join(shared_from_this());
-    //do_read_header();
-    do_read();
-  }
-
-  void deliver(const chat_message& msg)
-  {
-    bool write_in_progress = !write_msgs_.empty();
     write_msgs_.push_back(msg);
-    if (!write_in_progress)
+    
+    // held back while failing over, the join has to go first
+    if (!writing_ && connected_ && !is_host_)
     {
-      do_write();
+        do_write();
     }
-  }
+}
 
-private:
-    void do_read()
+void chat_client::report_load(std::size_t size)
+{
+    auto frame = std::make_shared<chat_frame>();
+    if (!is_host_ && !closed_ && encode_control(subtree{id_, std::uint32_t(size)}, format_, *frame))
+    {
+        send_upstream(frame);
+    }
+}
+
+void chat_client::do_write()
+{
+    // left over from a failover that made this peer the host; they may be
+    // shared, so the room numbers copies
+    if (is_host_)
     {
-        auto self(shared_from_this());
-        socket_.async_read_some(boost::asio::buffer(read_msg_.data(), read_msg_.capacity()),
-            [this, self](boost::system::error_code ec, std::size_t length)
+        for (const auto& msg: write_msgs_)
+        {
+            auto out = make_frame();
+            *out = *msg;
+            room_.deliver(out, no_participant);
+        }
+        write_msgs_.clear();
+        return;
+    }
+    
+    writing_ = async_write_queue(socket_, write_msgs_, gather_,
+        [this](boost::system::error_code ec, std::size_t /*length*/)
+        {
+            if (!ec)
             {
-                if (ec)
-                {
-                    socket_.close();
-                    return;
-                }
-                
-                auto r = read_msg_.consume(length);  
+                write_msgs_.pop_front(writing_);
+                writing_ = 0;
                 
-                if (r == buffer_t::intermediate)
-                {
-                    do_read();
-                }
-                else if (r == buffer_t::ok)
+                if (!write_msgs_.empty() && connected_)
                 {
-                    message msg;
-                    
-                    if (decode_message(read_msg_, msg))
-                    {
-                        if (id.empty()) id = msg.from;
-                        room_.deliver(read_msg_, msg.from);
-            
-                        std::cout << id << "> " << msg.body << std::endl;
-                    }
-                     
-                    do_read();
+                    do_write();
                 }
-                else
+            }
+            else
+            {
+                // the rest is sent to whoever is upstream next
+                writing_ = 0;
+                if (ec != boost::asio::error::operation_aborted)
                 {
-                    room_.leave(shared_from_this());
+                    LOG_WARNING("do_write err: {}", ec.message());
                     socket_.close();
                 }
-            });
-    }
-        
-    
-//   void do_read_header()
-//   {
-//     auto self(shared_from_this());
-//     boost::asio::async_read(socket_,
-//         boost::asio::buffer(read_msg_.data(), chat_message::header_length),
-//         [this, self](boost::system::error_code ec, std::size_t /*length*/)
-//         {
-//           if (!ec && read_msg_.decode_header())
-//           {
-//             do_read_body();
-//           }
-//           else
-//           {
-//             room_.leave(shared_from_this());
-//           }
-//         });
-//   }
-// 
-//   void do_read_body()
-//   {
-//     auto self(shared_from_this());
-//     boost::asio::async_read(socket_,
-//         boost::asio::buffer(read_msg_.body(), read_msg_.body_length()),
-//         [this, self](boost::system::error_code ec, std::size_t /*length*/)
-//         {
-//           if (!ec)
-//           {
-//             room_.deliver(read_msg_, id);
-//             
-//             std::cout.write(read_msg_.body(), read_msg_.body_length());
-//             std::cout << "\n";
-//             
-//             do_read_header();
-//           }
-//           else
-//           {
-//             room_.leave(shared_from_this());
-//           }
-//         });
-//   }
-
-  void do_write()
-  {
-    auto self(shared_from_this());
-    boost::asio::async_write(socket_,
-        boost::asio::buffer(write_msgs_.front().data(),
-          write_msgs_.front().length()),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/)
-        {
-          if (!ec)
-          {
-            write_msgs_.pop_front();
-            if (!write_msgs_.empty())
-            {
-              do_write();
-            }
-          }
-          else
-          {
-            room_.leave(shared_from_this());
-          }
+            }
         });
-  }
+}
 
-  tcp::socket socket_;
-  chat_room& room_;
-  chat_message read_msg_;
-  chat_message_queue write_msgs_;
-};
+void chat_client::join_upstream(const successor& peer, upstream kind)
+{
+    host_id_ = peer.id;
+    upstream_ = kind;
+    do_resolve(peer.host.address, peer.host.port);
+}
 
-struct chat_server
+// Losing a relay only moves this peer's subtree: it joins the host again
+// and is placed anew. Losing the host fails the room over.
+void chat_client::host_lost()
 {
-    chat_server(boost::asio::io_service& io, unsigned short port) : 
-      acceptor_ (io),
-      socket_   (io),
-      resolver_ (io),
-      port_ (port)
-    {}
+    bool was_connected = connected_;
     
-    void start_accept(const std::string& id)
+    connected_ = false;
+    socket_.close();
+    
+    if (closed_)
     {
-        PRINT_DEBUG ("Start accepting in %s room\n", id.c_str());
-        
-        tcp::endpoint local(tcp::endpoint(tcp::v4(), port_));
-        
-        acceptor_.open(local.protocol());
-        acceptor_.set_option(tcp::acceptor::reuse_address(true));
-        acceptor_.bind(local);
-        acceptor_.listen();
-        
-        do_accept(id);
+        return;
     }
     
-    void do_accept(const std::string& id)
+    if (was_connected)
     {
-        acceptor_.async_accept(socket_,
-        [this, id](boost::system::error_code ec)
-        {
-          if (!ec)
-          {
-            PRINT_DEBUG ("New user accepted\n");
-            std::make_shared<chat_session>(std::move(socket_), id, room_)->start();
-          }
-
-          do_accept(id);
-        });
+        output_.event(peer_event::host_left, host_id_);
     }
     
-protected:
-    tcp::acceptor acceptor_;
-    tcp::socket socket_;
-    tcp::resolver resolver_;
-    
-    unsigned short port_;
-    chat_room room_;
-};
+    if (upstream_ == upstream::relay)
+    {
+        join_upstream(root_, upstream::root);
+    }
+    else
+    {
+        fail_over(0);
+    }
+}
 
-typedef std::deque<chat_message> chat_message_queue;
+void chat_client::unreachable()
+{
+    if (closed_)
+    {
+        return;
+    }
+    
+    switch (upstream_)
+    {
+    case upstream::host:
+        retry_lookup();
+        break;
+    case upstream::root:
+        fail_over(0);
+        break;
+    case upstream::standby:
+        fail_over(next_successor_);
+        break;
+    case upstream::relay:
+        join_upstream(root_, upstream::root);
+        break;
+    }
+}
 
-class chat_client : public chat_server
+// The host the directory named does not answer, its lease may not have
+// run out yet. Asks the directory again after a while.
+void chat_client::retry_lookup()
 {
-public:
-  chat_client(boost::asio::io_service& io_service, tcp::resolver::iterator it,
-    const std::string room,
-    const std::string id,
-    unsigned short port = Port
-  )
-    : chat_server (io_service, port),
-      io_service_ (io_service),
-      socket_     (io_service),
-      write_msgs_ (),
-      
-      remote_(it),
-      srvsocket_  (io_service),
-      room_ (room),
-      id_   (id),
-      port_ (port)
-  {
-    do_connect_server(remote_);
-  }
-
-  void write(const chat_message& msg)
-  {
-    io_service_.post(
-        [this, msg]()
+    retry_timer_.expires_from_now(retry_delay_);
+    retry_delay_ = std::min(retry_delay_ * 2, lookup_retry_last);
+    
+    retry_timer_.async_wait(
+        [this](boost::system::error_code ec)
         {
-          bool write_in_progress = !write_msgs_.empty();
-          write_msgs_.push_back(msg);
-          if (!write_in_progress)
-          {
-            do_write();
-          }
+            if (ec || closed_) return;
+            
+            do_connect_server(remote_);
         });
-  }
+}
 
-  void close()
-  {
-    io_service_.post([this]() { socket_.close(); });
-  }
+// Walks the successors named by the lost host: takes the room over when
+// this peer is the next one, otherwise joins the first that answers. The
+// directory is asked only once every successor failed.
+void chat_client::fail_over(std::size_t next)
+{
+    if (next >= successors_.size())
+    {
+        successors_.clear();
+        upstream_ = upstream::host;
+        do_connect_server(remote_);
+        return;
+    }
+    
+    const auto& standby = successors_[next];
+    if (standby.id == id_)
+    {
+        host_room();
+        return;
+    }
+    
+    root_ = standby;
+    next_successor_ = next + 1;
+    join_upstream(standby, upstream::standby);
+}
 
-private:
-  void do_connect(tcp::resolver::iterator remote)
-  {
-      PRINT_DEBUG ("Connecting to %s\n", remote->host_name().c_str());
-    boost::asio::async_connect(socket_, remote,
-        [this](boost::system::error_code ec, tcp::resolver::iterator)
-        {
-          if (!ec)
-          {
-            std::cout << "system> You are connected. " << host_id_ << " is host of the room" << std::endl;
-            //do_read_header();
-            do_read();
-          }
-        });
-  }
-  
-   void do_resolve(const std::string address, unsigned int port)
+void chat_client::host_room()
+{
+    output_.event(peer_event::hosting, id_);
+    
+    is_host_ = true;
+    root_ = successor{id_, host_};
+    host_id_ = id_;
+    room_.hosting();
+    
+    start_accept();
+    
+    // members this peer relayed to are its successors now; the directory
+    // hears about the takeover at once rather than at the next beat
+    announce(room_.successors());
+    do_heartbeat();
+    
+    if (!write_msgs_.empty())
     {
-        PRINT_DEBUG ("Resolving %s:%d ...\n", address.c_str(), port);
-        tcp::resolver::query query(address, std::to_string(port));
-        resolver_.async_resolve(query,
-            [this](const boost::system::error_code& ec, tcp::resolver::iterator it)
-            {
-                if (!ec)
-                {
-                    do_connect(it);
-                }
-                else
-                {
-                    PRINT_DEBUG ("Failed to resolve host address! %s!\n", ec.message().c_str());
-                }
-            });
+        do_write();
+    }
+}
+
+void chat_client::announce(const std::vector<successor>& successors)
+{
+    if (closed_ || !is_host_)
+    {
+        return;
     }
     
-    void do_read()
+    successors_ = successors;
+    
+    auto frame = std::make_shared<chat_frame>();
+    if (encode_control(standby{id_, room_id_, successors_}, format_, *frame))
     {
-        socket_.async_read_some(boost::asio::buffer(read_msg_.data(), read_msg_.capacity()),
-            [this](boost::system::error_code ec, std::size_t length)
-            {
-                if (ec)
-                {
-                    socket_.close();
-                    
-                    std::cout << "system> " <<host_id_ << " left." << std::endl;
-                    do_connect_server(remote_);
-                    
-                    return;
-                }
-                
-                auto r = read_msg_.consume(length);  
-                
-                if (r == buffer_t::intermediate)
-                {
-                    do_read();
-                }
-                else if (r == buffer_t::ok)
-                {
-                    message msg;
-                    
-                    if (decode_message(read_msg_, msg))
-                    {
-                        std::cout << msg.from << "> " << msg.body << std::endl;
-                    }
-                     
-                    do_read();
-                }
-                else
-                {
-                    socket_.close();
-                }
-            });
-    }
-    
-  void do_write()
-  {
-      if (is_host_)
-      {
-          chat_server::room_.deliver(write_msgs_.front(), id_);
-          write_msgs_.pop_front();
-      }
-      else
-      {
-        boost::asio::async_write(socket_,
-            boost::asio::buffer(write_msgs_.front().data(),
-            write_msgs_.front().length()),
-            [this](boost::system::error_code ec, std::size_t /*length*/)
-            {
-            if (!ec)
+        room_.announce(frame);
+    }
+    
+    do_renew();
+}
+
+void chat_client::do_connect_server(tcp::resolver::iterator it)
+{
+    boost::asio::async_connect(srvsocket_, it,
+        [this](boost::system::error_code ec, tcp::resolver::iterator)
+        {
+            if (!ec && !closed_)
             {
-                write_msgs_.pop_front();
-                if (!write_msgs_.empty())
-                {
-                do_write();
-                }
+                do_send_request();
             }
             else
             {
-                std::cout << "do_write err: " << ec.message() << std::endl;
-                socket_.close();
+                srvsocket_.close();
             }
-            });
-      }
-  }
-  
-    void do_connect_server(tcp::resolver::iterator it)
-    {
-        boost::asio::async_connect(srvsocket_, it,
-        [this](boost::system::error_code ec, tcp::resolver::iterator)
-        {
-          if (!ec)
-          {
-            do_send_request();
-          }
-          else
-          {
-            srvsocket_.close();
-          }
         });
+}
+
+template <typename T>
+bool chat_client::encode(const T& pdu, std::string& buf)
+{
+    buf.clear();
+    
+    if (format_ == wire_format::binary)
+    {
+        return encode_binary(pdu, buf);
     }
- 
-   
-    void do_send_request()
+    
+    buf_.reset();
+    if (!encode_text(pdu, buf_))
     {
-        buf_.reset();
-        
-        connect_req req{id_, room_, {srvsocket_.local_endpoint().address().to_string(), port_}};
-        
-        if (!encode_connection_req(req, buf_))
-        {
-            std::cout << buf_.data()[buf_.length() - 1] << std::endl;
-            
-            srvsocket_.close();
-            return;
-        }
-        
-        boost::asio::async_write(srvsocket_, boost::asio::buffer(buf_.data(), buf_.length()),
+        return false;
+    }
+    
+    buf.assign(buf_.data(), buf_.length());
+    return true;
+}
+
+void chat_client::do_send_request()
+{
+    response_.reset();
+    
+    host_ = {srvsocket_.local_endpoint().address().to_string(), port_};
+    connect_req req{id_, room_id_, host_};
+    
+    if (!encode(req, request_))
+    {
+        srvsocket_.close();
+        return;
+    }
+    
+    boost::asio::async_write(srvsocket_, boost::asio::buffer(request_),
         [this](boost::system::error_code ec, std::size_t /*length*/)
         {
             if (!ec)
@@ -455,15 +1490,11 @@ private:
                 srvsocket_.close();
             }
         });
-    }
-    
-    void do_send_info()
-    {
-    }
-    
-    void do_read_response()
-    {
-        srvsocket_.async_read_some(boost::asio::buffer(buf_.data(), buf_.capacity()),
+}
+
+void chat_client::do_read_response()
+{
+    srvsocket_.async_read_some(boost::asio::buffer(response_.tail(), response_.tail_size()),
         [this](boost::system::error_code ec, std::size_t length)
         {
             if (ec)
@@ -472,16 +1503,15 @@ private:
                 return;
             }
             
-            auto r = buf_.consume(length);
-            if (r == buffer_t::intermediate)
-            {
-                do_read_response();
-            }
-            else if (r == buffer_t::ok)
+            response_.commit(length);
+            
+            boost::string_view frame;
+            if (response_.next(frame))
             {
                 connect_res res;
+                bool ok = is_binary(frame) ? decode_binary(frame, res) : decode_connect_res(frame, res);
                 
-                if (!decode_connect_res(buf_, res) or res.status != 0)
+                if (!ok or res.status != 0)
                 {
                     srvsocket_.close();
                     return;
@@ -490,90 +1520,107 @@ private:
                 if (res.host)
                 {
                     srvsocket_.close();
-                    host_id_ = res.host_id;
                     is_host_ = false;
-                    do_resolve(res.host.get().address, res.host.get().port);
+                    root_ = successor{res.host_id, *res.host};
+                    join_upstream(root_, upstream::host);
                 }
                 else
                 {
-                    std::cout << "system> You are now host of the room." << std::endl;
-                    
                     // need to become host
-                    is_host_ = true;
-                    start_accept(id_);
+                    host_room();
                 }
             }
+            else if (!response_.full())
+            {
+                do_read_response();
+            }
             else
             {
                 srvsocket_.close();
             }
         });
-    }
+}
 
-private:
-  boost::asio::io_service& io_service_;
-  tcp::socket socket_;
-  chat_message read_msg_;
-  chat_message_queue write_msgs_;
-  
-    tcp::resolver::iterator remote_;
-    tcp::socket srvsocket_;
-    std::string room_;
-    std::string id_;
-    unsigned short port_;
-    
-    buffer_t buf_;
-    
-    std::string host_id_;
-    bool is_host_{false};
-};
+void chat_client::do_heartbeat()
+{
+    heartbeat_timer_.expires_from_now(heartbeat_interval);
+    heartbeat_timer_.async_wait(
+        [this](boost::system::error_code ec)
+        {
+            if (ec || closed_) return;
+            
+            do_renew();
+            do_heartbeat();
+        });
+}
 
-int main(int argc, char* argv[])
+void chat_client::do_renew()
 {
-  try
-  {
-    if (argc != 6)
+    if (heartbeat_busy_)
     {
-      std::cerr << "Usage: chat_client <host> <port> <room> <name> <listen_port>\n";
-      return 1;
+        heartbeat_again_ = true;
+        return;
     }
     
-    boost::asio::io_service io_service;
-
-    tcp::resolver resolver(io_service);
-    auto remote = resolver.resolve({ argv[1], argv[2] });
+    if (srvsocket_.is_open())
+    {
+        do_send_heartbeat();
+        return;
+    }
     
-    std::string room(argv[3]);
-    std::string id(argv[4]);
-    chat_client c(io_service, remote, room, id, std::atoi(argv[5]));
+    // directory went away, or this peer took the room over; renew the
+    // lease over a new connection
+    heartbeat_busy_ = true;
+    boost::asio::async_connect(srvsocket_, remote_,
+        [this](boost::system::error_code ec, tcp::resolver::iterator)
+        {
+            heartbeat_busy_ = false;
+            
+            if (!ec && !closed_)
+            {
+                do_send_heartbeat();
+            }
+            else
+            {
+                heartbeat_again_ = false;
+                srvsocket_.close();
+            }
+        });
+}
 
-    std::thread t([&io_service](){ io_service.run(); });
-    
-    // give a chance thread to run
-    std::this_thread::sleep_for(std::chrono::seconds(2)); 
+// The successors ride along with every heartbeat, so the directory has
+// them again after a restart. One write or connect at a time, a beat asked
+// for meanwhile follows it.
+void chat_client::do_send_heartbeat()
+{
+    if (heartbeat_busy_)
+    {
+        heartbeat_again_ = true;
+        return;
+    }
     
-    message input { id };
-    while (std::getline(std::cin, input.body))
+    heartbeat hb{id_, room_id_, host_};
+    if (!encode(hb, heartbeat_)
+        || !encode_control(standby{id_, room_id_, successors_}, format_, heartbeat_))
     {
-        if (input.body.empty()) continue;
-        
-        std::cout << "\e[A" << "You> " << input.body << std::endl;
-        
-        chat_message msg;
-        
-        if (encode_message(input, msg))
-        {
-            c.write(msg);
-        }
+        return;
     }
-
-    c.close();
-    t.join();
-  }
-  catch (std::exception& e)
-  {
-    std::cerr << "Exception: " << e.what() << "\n";
-  }
-
-  return 0;
+    
+    heartbeat_busy_ = true;
+    boost::asio::async_write(srvsocket_, boost::asio::buffer(heartbeat_),
+        [this](boost::system::error_code ec, std::size_t /*length*/)
+        {
+            heartbeat_busy_ = false;
+            
+            if (ec)
+            {
+                heartbeat_again_ = false;
+                srvsocket_.close();
+            }
+            else if (heartbeat_again_)
+            {
+                heartbeat_again_ = false;
+                do_send_heartbeat();
+            }
+        });
 }
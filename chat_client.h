@@ -0,0 +1,650 @@
+#ifndef CHAT_CLIENT_H
+#define CHAT_CLIENT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/circular_buffer.hpp>
+
+#include "chat_structures.h"
+#include "chat_binary.h"
+#include "chat_segments.h"
+#include "handler_alloc.h"
+#include "latency_histogram.h"
+
+using boost::asio::ip::tcp;
+
+const unsigned short Port = 12345;
+
+// well inside the directory's default 30 second lease
+const auto heartbeat_interval = std::chrono::seconds(10);
+
+// the directory is asked again when the host it named does not answer,
+// after a delay that doubles from the first to the last
+const auto lookup_retry_first = std::chrono::milliseconds(100);
+const auto lookup_retry_last = std::chrono::milliseconds(5000);
+
+// larger messages are refused by both sender and receiver, see -m
+extern std::size_t max_message_size;
+
+// bytes a session hands to one gather write, see -w
+extern std::size_t max_write_batch;
+
+// messages the host keeps for replay to joiners, see -r
+extern std::size_t history_depth;
+
+// participants the host names as its successors, see -k
+extern std::size_t standby_count;
+
+// members a peer takes before it sends joiners down to relays, 0 for no
+// limit, see -f
+extern std::size_t relay_fanout;
+
+// Members per session strand of a room, see chat_room::session_strand().
+const std::size_t fanout_slice = 256;
+
+typedef boost::asio::strand<boost::asio::io_service::executor_type> chat_strand;
+
+// A host session's socket. Typed with its strand, so asio never wraps the
+// strand in a type-erased executor, which would allocate per operation.
+typedef boost::asio::basic_stream_socket<tcp, chat_strand> session_socket;
+
+// What a host session does with a participant that does not keep up.
+enum class overflow_policy
+{
+    drop_oldest,    // make room by dropping queued messages not yet written
+    drop_newest,    // refuse the new message
+    disconnect      // drop new messages and evict if still full after grace
+};
+
+struct queue_limits
+{
+    std::size_t messages{1024};
+    std::size_t bytes{4 << 20};
+    overflow_policy policy{overflow_policy::drop_oldest};
+    std::chrono::milliseconds grace{5000};
+};
+
+// set with -q, -b, -p and -g
+extern queue_limits send_limits;
+
+// shown by typing /stats
+struct queue_stats
+{
+    std::atomic<std::uint64_t> dropped{0};
+    std::atomic<std::uint64_t> evicted{0};
+};
+
+extern queue_stats send_stats;
+
+//----------------------------------------------------------------------
+
+// Messages that fit a buffer_t travel as text in it, exactly as before.
+// Anything bigger is a binary frame kept in pooled segments and written
+// with gather I/O, so it is never copied into one contiguous block.
+struct chat_frame
+{
+    buffer_t small;
+    segment_chain large;
+    
+    // when set, the frame is these frames back to back (history replay)
+    std::vector<std::shared_ptr<const chat_frame>> parts;
+};
+
+// A message is encoded once and never changed after the room got it, the
+// history and every session queue only hold references to it.
+typedef std::shared_ptr<const chat_frame> chat_message;
+
+// Messages waiting to be written, oldest first. A ring that doubles when
+// full and keeps its capacity, so a session that caught up never
+// allocates; a host session's stays within send_limits.messages. Writes
+// take from the front and drop_oldest drops behind the current write
+// without moving the rest.
+class chat_message_queue
+{
+public:
+    typedef boost::circular_buffer<chat_message>::const_iterator const_iterator;
+    
+    bool empty() const { return ring_.empty(); }
+    std::size_t size() const { return ring_.size(); }
+    const_iterator begin() const { return ring_.begin(); }
+    const_iterator end() const { return ring_.end(); }
+    const chat_message& operator[](std::size_t i) const { return ring_[i]; }
+    
+    void push_back(const chat_message& msg)
+    {
+        grow();
+        ring_.push_back(msg);
+    }
+    
+    void push_front(const chat_message& msg)
+    {
+        grow();
+        ring_.push_front(msg);
+    }
+    
+    // the `n` oldest
+    void pop_front(std::size_t n) { ring_.erase_begin(n); }
+    
+    // message `i`, the ones before it move up
+    void erase(std::size_t i) { ring_.rerase(ring_.begin() + i); }
+    
+    void clear() { ring_.clear(); }
+
+private:
+    void grow()
+    {
+        if (ring_.full())
+        {
+            ring_.set_capacity(std::max<std::size_t>(16, 2 * ring_.capacity()));
+        }
+    }
+    
+    boost::circular_buffer<chat_message> ring_;
+};
+
+// An empty frame for a message, from a pool: once a room's history is
+// full it lets go of a frame for every one it takes.
+std::shared_ptr<chat_frame> make_frame();
+
+std::size_t frame_size(const chat_frame& msg);
+void append_buffers(const chat_frame& msg, std::vector<boost::asio::const_buffer>& out);
+
+bool encode_chat_message(const message& msg, chat_frame& out);
+
+// Microseconds of the wall clock, for message::sent.
+std::uint64_t wall_clock_us();
+
+// Control frames in either format, text ones terminated.
+bool encode_control(const join& pdu, wire_format format, std::string& buf);
+bool encode_control(const standby& pdu, wire_format format, std::string& buf);
+bool encode_control(const redirect& pdu, wire_format format, std::string& buf);
+bool encode_control(const subtree& pdu, wire_format format, std::string& buf);
+
+template <typename T>
+bool encode_control(const T& pdu, wire_format format, chat_frame& out)
+{
+    std::string buf;
+    if (!encode_control(pdu, format, buf))
+    {
+        return false;
+    }
+    
+    out.large.append(buf);
+    return true;
+}
+
+// Keeps a received frame for forwarding to the other participants.
+void store_frame(boost::string_view frame, chat_frame& out);
+
+// Sets the number of a stored message, see message::seq.
+bool stamp_frame(chat_frame& frame, std::uint32_t seq);
+
+bool decode_any(boost::string_view frame, message_view& msg);
+bool decode_any(boost::string_view frame, join& msg);
+bool decode_any(boost::string_view frame, standby& msg);
+bool decode_any(boost::string_view frame, redirect& msg);
+bool decode_any(boost::string_view frame, subtree& msg);
+
+// Size of a binary frame at the start of `in` that can never fit it, or 0.
+template <int N>
+std::size_t oversized_frame(const stream_buffer<N>& in)
+{
+    auto rest = in.pending();
+    if (!is_binary(rest) || rest.size() < binary_header_size)
+    {
+        return 0;
+    }
+    
+    auto size = binary_frame_size(rest.data());
+    return size > in.capacity ? size : 0;
+}
+
+// Writes the body of a large message, which starts `skip` bytes into it.
+void print_body(std::ostream& os, const segment_chain& chain, std::size_t skip);
+
+// Buffer sequence over a vector that outlives the write, so starting the
+// write does not copy the buffer list.
+struct buffer_span
+{
+    typedef boost::asio::const_buffer value_type;
+    typedef const boost::asio::const_buffer* const_iterator;
+    
+    const_iterator begin() const { return first; }
+    const_iterator end() const { return last; }
+    
+    const_iterator first;
+    const_iterator last;
+};
+
+// Collects the buffers of the messages at the front of `queue`, up to `cap`
+// bytes but at least one message, and returns how many messages they hold.
+std::size_t gather(const chat_message_queue& queue, std::size_t cap,
+    std::vector<boost::asio::const_buffer>& out);
+
+template <typename Socket, typename Handler>
+std::size_t async_write_queue(Socket& socket, const chat_message_queue& queue,
+    std::vector<boost::asio::const_buffer>& buffers, Handler handler)
+{
+    auto count = gather(queue, max_write_batch, buffers);
+    boost::asio::async_write(socket, buffer_span{buffers.data(), buffers.data() + buffers.size()}, std::move(handler));
+    return count;
+}
+
+//----------------------------------------------------------------------
+
+enum class peer_event
+{
+    connected,      // joined the room hosted by `who`
+    hosting,        // this peer hosts the room now
+    host_left       // lost the connection to `who`
+};
+
+// Where a peer reports what happens in its room. Called from any strand,
+// the console unless a peer is given another one.
+class chat_output
+{
+public:
+    virtual ~chat_output() {}
+    
+    virtual void message(boost::string_view from, boost::string_view body) = 0;
+    
+    // a large message, its body starts `skip` bytes into `frame`
+    virtual void message(boost::string_view from, const segment_chain& frame, std::size_t skip) = 0;
+    
+    virtual void event(peer_event e, const std::string& who) = 0;
+    
+    // after the messages of one read
+    virtual void flush() {}
+};
+
+class console_output : public chat_output
+{
+public:
+    void message(boost::string_view from, boost::string_view body) override;
+    void message(boost::string_view from, const segment_chain& frame, std::size_t skip) override;
+    void event(peer_event e, const std::string& who) override;
+    void flush() override;
+};
+
+chat_output& console();
+
+//----------------------------------------------------------------------
+
+class chat_participant
+{
+public:
+    virtual ~chat_participant() {}
+    virtual void deliver(const chat_message& msg) = 0;
+    virtual void close() = 0;
+    
+    std::string id;
+};
+
+typedef std::shared_ptr<chat_participant> chat_participant_ptr;
+
+// Slot of a participant in its room, valid from join() until leave().
+// Freed slots are reused, so leave() a slot only once.
+typedef std::uint32_t participant_id;
+const participant_id no_participant = ~participant_id(0);
+
+//----------------------------------------------------------------------
+
+// Members are kept in one dense array. `positions_` maps a slot to the
+// member's index, which lets leave() swap the last member into the hole.
+// Called from any session's strand, all state is behind `mutex_`.
+//
+// Every peer has a room. The host's holds the participants; in relay mode
+// a participant's holds the subtree it relays to, and it is only a
+// history for everyone else.
+class chat_room
+{
+public:
+    typedef std::function<void(const std::vector<successor>&)> succession_handler;
+    typedef std::function<void(std::size_t)> load_handler;
+    typedef std::function<void(const chat_message&)> forward_handler;
+    
+    explicit chat_room(boost::asio::io_service& io, std::size_t depth = history_depth);
+    
+    // The strand a new session runs on. Broadcasts reach a member on it,
+    // see deliver(); round robin over at least one strand per core.
+    chat_strand session_strand();
+    
+    // Replays the history after message `after` to the new member, all of
+    // it for 0. `strand` is the member's, from session_strand().
+    participant_id join(chat_participant_ptr participant, const chat_strand& strand, std::uint32_t after = 0);
+    void leave(participant_id slot);
+    
+    // Offers a member as standby host. The first standby_count members to
+    // enlist are the room's successors, in that order.
+    void enlist(participant_id slot, const successor& info);
+    std::vector<successor> successors();
+    
+    // Relay mode: true if the room has relay_fanout members already, `relay`
+    // is then the enlisted member with the smallest subtree.
+    bool place(successor& relay);
+    
+    // Relay mode: the subtree under a member, as it reported it.
+    void set_load(participant_id slot, std::size_t size);
+    
+    // The host's room numbers the message and every member gets it, its
+    // sender `from` too, so each peer keeps its own messages in its history.
+    // Other rooms hand a member's message to the forward handler only, it
+    // comes back numbered from upstream, as no_participant's, and then
+    // every member gets it under the number `seq` it came with.
+    void deliver(const std::shared_ptr<chat_frame>& msg, participant_id from, std::uint32_t seq = 0,
+        std::uint64_t sent = 0);
+    
+    // Latency from the sender's write: to the host's deliver(), counted
+    // where the room is hosted, and to this peer, counted by received().
+    void received(std::uint64_t sent);
+    const latency_histogram& to_host() const { return to_host_; }
+    const latency_histogram& to_peer() const { return to_peer_; }
+    
+    // Sends the successor list to every member, and to members that enlist
+    // later on. It is not part of the history.
+    void announce(const chat_message& msg);
+    
+    // Called with the new successors whenever they change, under the lock.
+    void on_succession(succession_handler handler);
+    
+    // Called with the size of the subtree under this peer, itself
+    // included, whenever it changes. Also under the lock.
+    void on_load(load_handler handler);
+    
+    // Called with every message from a member, outside the lock, unless the
+    // room is hosted here.
+    void on_forward(forward_handler handler);
+    
+    // Set once the peer hosts the room, from then on it numbers messages.
+    void hosting();
+    bool hosted() const { return hosting_; }
+    
+    std::size_t load();
+    
+    // Closes every member, when the host leaves the room.
+    void close();
+
+private:
+    chat_message history(std::uint32_t after);
+    void push_history(const chat_message& msg, std::uint32_t seq);
+    void succession_changed();
+    void load_changed();
+    
+    struct member
+    {
+        participant_id slot;
+        chat_participant_ptr participant;
+        std::size_t strand;     // index into outlets_
+    };
+    
+    // the members on one strand
+    struct slice
+    {
+        std::vector<member> members;
+    };
+    
+    typedef std::shared_ptr<const std::vector<slice>> slices_ptr;
+    
+    struct queued
+    {
+        chat_message msg;
+        slices_ptr slices;      // the members when it was delivered
+    };
+    
+    // Messages waiting for a strand. One handler takes all there are, so a
+    // burst costs a post per strand rather than one per message.
+    struct outlet
+    {
+        outlet(const chat_strand& s, std::size_t i) : strand(s), index(i) {}
+        
+        chat_strand strand;
+        std::size_t index;
+        std::vector<queued> pending;    // under mutex_
+        bool scheduled{false};          // under mutex_, a drain is due
+        std::vector<queued> draining;   // the drain's
+    };
+    
+    struct candidate
+    {
+        participant_id slot;
+        successor info;
+        std::size_t load;
+    };
+    
+    struct numbered
+    {
+        std::uint32_t seq;
+        chat_message msg;
+    };
+    
+    // Snapshot of the members for broadcasts, rebuilt after membership changed.
+    void build_slices();
+    void drain(outlet& out);
+    
+    boost::asio::io_service& io_;
+    std::mutex mutex_;
+    std::vector<member> members_;
+    std::vector<std::uint32_t> positions_;
+    std::vector<participant_id> free_slots_;
+    std::vector<std::unique_ptr<outlet>> outlets_;
+    std::size_t next_strand_{0};
+    slices_ptr slices_;
+    
+    // Message `seq` is at ring_[seq % depth_] until it is overwritten, so
+    // replaying from any number starts without a search.
+    std::size_t depth_;
+    std::vector<numbered> ring_;
+    std::uint32_t next_seq_{1};
+    chat_message history_;
+    
+    std::vector<candidate> candidates_;
+    chat_message standby_;
+    succession_handler succession_;
+    
+    std::size_t load_{1};
+    load_handler on_load_;
+    forward_handler forward_;
+    std::atomic<bool> hosting_{false};
+    
+    latency_histogram to_host_;
+    latency_histogram to_peer_;
+};
+
+//----------------------------------------------------------------------
+
+// Host side of a participant's connection. The first frame is the join,
+// everything after it is messages for the room. In relay mode the join may
+// be answered with a redirect to a relay instead, and a relay reports the
+// size of its subtree.
+class chat_session
+    : public chat_participant,
+      public std::enable_shared_from_this<chat_session>
+{
+public:
+    chat_session(session_socket socket, const std::string& owner, chat_room& room, chat_output& output) :
+        socket_(std::move(socket)),
+        strand_(socket_.get_executor()),
+        owner_(owner),
+        room_(room),
+        output_(output),
+        grace_timer_(socket_.get_executor())
+    {}
+    
+    void start();
+    void deliver(const chat_message& msg) override;
+    void close() override;
+
+private:
+    void enqueue(const chat_message& msg);
+    void leave();
+    
+    bool fits(std::size_t size) const;
+    bool make_room(std::size_t size);
+    void start_grace();
+    
+    void do_read();
+    void do_read_large(std::size_t size);
+    void do_write();
+    
+    session_socket socket_;
+    chat_strand strand_;
+    std::string owner_;
+    chat_room& room_;
+    chat_output& output_;
+    participant_id slot_{no_participant};
+    stream_buffer<8192> in_;
+    segment_chain large_;
+    chat_message_queue write_msgs_;
+    std::vector<boost::asio::const_buffer> gather_;
+    std::size_t writing_{0};
+    std::size_t queued_bytes_{0};
+    
+    // reads follow reads and writes follow writes, each has a block
+    handler_memory read_memory_;
+    handler_memory write_memory_;
+    
+    boost::asio::steady_timer grace_timer_;
+    bool over_limit_{false};
+};
+
+// Accepting side of a peer. It listens from the start, so participants
+// failing over to this peer queue in the backlog until it takes over, but
+// only accepts once it hosts the room or is connected to it, as a relay.
+// Port 0 picks a free port.
+//
+// Runs on a thread pool: the acceptor and everything of chat_client are
+// serialized on `strand_`, sessions run on the strands of the room.
+class chat_host
+{
+public:
+    chat_host(boost::asio::io_service& io, const std::string& id, unsigned short port,
+        chat_output& output);
+    
+    unsigned short port() const { return port_; }
+    chat_room& room() { return room_; }
+
+protected:
+    void start_accept();
+    void do_accept();
+    
+    boost::asio::io_service& io_;
+    chat_strand strand_;
+    tcp::acceptor acceptor_;
+    tcp::resolver resolver_;
+    
+    std::string id_;
+    unsigned short port_;
+    bool accepting_{false};
+    chat_output& output_;
+    chat_room room_;
+};
+
+class chat_client : public chat_host
+{
+public:
+    chat_client(boost::asio::io_service& io_service, tcp::resolver::iterator it,
+        const std::string& room,
+        const std::string& id,
+        unsigned short port = Port,
+        wire_format format = wire_format::text,
+        chat_output& output = console());
+    
+    // Sends a message encoded into a frame from make_frame(). The host
+    // numbers it in place and keeps it, so it is not written again.
+    void write(std::shared_ptr<chat_frame> msg);
+    
+    // Leaves the room for good. The room moves to the successors if this
+    // peer hosts it.
+    void close();
+    
+    const std::string& id() const { return id_; }
+
+private:
+    void do_resolve(const std::string& address, unsigned short port);
+    void do_connect(tcp::resolver::iterator remote);
+    void do_read();
+    void do_read_large(std::size_t size);
+    void handle(boost::string_view frame);
+    void track_seq(std::uint32_t seq);
+    void send_upstream(const chat_message& msg);
+    void report_load(std::size_t size);
+    void do_write();
+    
+    // who this peer is connected to, and so what to do when it is lost
+    enum class upstream
+    {
+        host,       // as named by the directory
+        root,       // the host again, after losing a relay
+        standby,    // a successor of the lost host
+        relay       // where the host redirected the join to
+    };
+    
+    void join_upstream(const successor& peer, upstream kind);
+    void host_lost();
+    void unreachable();
+    void retry_lookup();
+    void fail_over(std::size_t next);
+    void host_room();
+    void announce(const std::vector<successor>& successors);
+    
+    void do_connect_server(tcp::resolver::iterator it);
+    
+    template <typename T>
+    bool encode(const T& pdu, std::string& buf);
+    
+    static bool encode_text(const connect_req& req, buffer_t& buf) { return encode_connection_req(req, buf); }
+    static bool encode_text(const heartbeat& hb, buffer_t& buf) { return encode_heartbeat(hb, buf); }
+    
+    void do_send_request();
+    void do_read_response();
+    void do_heartbeat();
+    void do_renew();
+    void do_send_heartbeat();
+    
+    tcp::socket socket_;
+    stream_buffer<8192> in_;
+    segment_chain large_;
+    chat_message_queue write_msgs_;
+    std::vector<boost::asio::const_buffer> gather_;
+    std::size_t writing_{0};
+    bool connected_{false};
+    
+    tcp::resolver::iterator remote_;
+    tcp::socket srvsocket_;
+    boost::asio::steady_timer heartbeat_timer_;
+    boost::asio::steady_timer retry_timer_;
+    std::chrono::milliseconds retry_delay_{lookup_retry_first};
+    std::string room_id_;
+    host_info host_;
+    wire_format format_;
+    
+    buffer_t buf_;
+    std::string request_;
+    std::string heartbeat_;
+    bool heartbeat_busy_{false};
+    bool heartbeat_again_{false};
+    stream_buffer<1024> response_;
+    
+    std::string host_id_;
+    successor root_;
+    upstream upstream_{upstream::host};
+    boost::optional<successor> redirect_;
+    std::uint32_t last_seq_{0};     // every message up to it arrived
+    bool is_host_{false};
+    bool closed_{false};
+    
+    // named by the host, or by this peer when it hosts the room
+    std::vector<successor> successors_;
+    std::size_t next_successor_{0};
+};
+
+#endif
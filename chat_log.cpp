@@ -0,0 +1,486 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cache_aligned.h"
+#include "chat_log.h"
+
+std::atomic<std::uint8_t> log_threshold{std::uint8_t(log_level::info)};
+
+namespace
+{
+
+const std::size_t ring_size = 1 << 16;      // bytes per thread, a power of two
+const std::size_t max_string = 1024;        // longer arguments are cut
+const auto drain_interval = std::chrono::milliseconds(5);
+
+struct record_head
+{
+    std::uint32_t size;     // with the arguments
+    log_level level;
+    std::uint8_t count;
+    std::uint64_t time;     // system clock, nanoseconds
+    const char* format;
+};
+
+// Bytes one thread logs and the drain thread takes. head_ is only written
+// by the producer, tail_ only by the drain thread. Retired once its thread
+// exits, the drain thread frees it after taking the rest.
+class log_ring
+{
+public:
+    log_ring() : data_(new char[ring_size]) {}
+    
+    bool push(const record_head& head, const log_arg* args)
+    {
+        auto start = head_.load(std::memory_order_relaxed);
+        if (start + head.size - tail_.load(std::memory_order_acquire) > ring_size)
+        {
+            dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        
+        auto pos = start;
+        put(pos, &head, sizeof head);
+        
+        for (std::size_t i = 0; i < head.count; ++i)
+        {
+            auto& a = args[i];
+            put(pos, &a.tag, 1);
+            
+            if (a.tag == 's')
+            {
+                std::uint32_t n = std::min(a.s.size(), max_string);
+                put(pos, &n, sizeof n);
+                put(pos, a.s.data(), n);
+            }
+            else
+            {
+                put(pos, &a.u, sizeof a.u);
+            }
+        }
+        
+        head_.store(start + head.size, std::memory_order_release);
+        return true;
+    }
+    
+    // appends every record pushed so far to `out`
+    void take(std::string& out)
+    {
+        auto end = head_.load(std::memory_order_acquire);
+        auto start = tail_.load(std::memory_order_relaxed);
+        
+        auto at = start & (ring_size - 1);
+        auto n = end - start;
+        auto first = std::min(n, ring_size - at);
+        out.append(data_.get() + at, first);
+        out.append(data_.get(), n - first);
+        
+        tail_.store(end, std::memory_order_release);
+    }
+    
+    bool empty() const
+    {
+        return head_.load(std::memory_order_seq_cst) == tail_.load(std::memory_order_relaxed);
+    }
+    
+    std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    
+    // after the last push
+    void retire() { retired_.store(true, std::memory_order_release); }
+    bool retired() const { return retired_.load(std::memory_order_acquire); }
+
+private:
+    void put(std::size_t& pos, const void* p, std::size_t n)
+    {
+        auto at = pos & (ring_size - 1);
+        auto first = std::min(n, ring_size - at);
+        std::memcpy(data_.get() + at, p, first);
+        std::memcpy(data_.get(), static_cast<const char*>(p) + first, n - first);
+        pos += n;
+    }
+    
+    std::unique_ptr<char[]> data_;
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<bool> retired_{false};
+};
+
+std::size_t record_size(const log_arg* args, std::size_t count)
+{
+    auto size = sizeof(record_head);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        size += 1 + (args[i].tag == 's'
+            ? sizeof(std::uint32_t) + std::min(args[i].s.size(), max_string)
+            : sizeof(std::uint64_t));
+    }
+    
+    return size;
+}
+
+template <typename T>
+T read(const char*& p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof v);
+    p += sizeof v;
+    return v;
+}
+
+// Owns the rings and the drain thread. Never destroyed, threads may still
+// log while the process exits; the exit handler writes out the rest.
+//
+// The drain thread passes over the rings every drain_interval while there
+// is something to take, and sleeps once a pass found nothing. `idle_` is
+// set before its last look at the rings and producers check it after
+// their push, so one of them sees the other; only the producer that finds
+// it set wakes the thread.
+class log_sink
+{
+public:
+    log_ring* attach()
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(make_aligned<log_ring>());
+        return rings_.back().get();
+    }
+    
+    // the ring's thread exits, it is freed once drained
+    void retire(log_ring* ring)
+    {
+        ring->retire();
+        wake();
+    }
+    
+    void wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle_.load(std::memory_order_relaxed) && idle_.exchange(false))
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            wake_.notify_one();
+        }
+    }
+    
+    void set_file(std::FILE* file)
+    {
+        std::lock_guard<std::mutex> lock(drain_mutex_);
+        file_ = file;
+    }
+    
+    void run()
+    {
+        bool took = false;
+        while (drain(false, &took))
+        {
+            if (took)
+            {
+                std::this_thread::sleep_for(drain_interval);
+            }
+            else
+            {
+                wait();
+            }
+        }
+    }
+    
+    // False once stopped. `took` tells whether there was anything to take.
+    bool drain(bool stop = false, bool* took = nullptr);
+
+private:
+    struct pending
+    {
+        std::uint64_t time;
+        const char* record;
+    };
+    
+    void format(const char* record);
+    void stamp(std::uint64_t time, log_level level);
+    void wait();
+    
+    std::mutex rings_mutex_;
+    std::vector<aligned_ptr<log_ring>> rings_;
+    
+    std::atomic<bool> idle_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    
+    // the rest is the drain thread's, or the exit handler's
+    std::mutex drain_mutex_;
+    std::FILE* file_{stdout};
+    bool stopped_{false};
+    std::vector<std::string> taken_;
+    std::vector<pending> pending_;
+    std::string out_;
+    std::uint64_t reported_drops_{0};
+    std::uint64_t retired_drops_{0};     // of the rings freed
+    
+    std::time_t second_{-1};
+    char clock_[16];
+};
+
+bool log_sink::drain(bool stop, bool* took)
+{
+    std::lock_guard<std::mutex> lock(drain_mutex_);
+    if (stopped_)
+    {
+        return false;
+    }
+    
+    stopped_ = stop;
+    if (stop)
+    {
+        // the drain thread sees stopped_ and returns
+        wake();
+    }
+    
+    std::vector<log_ring*> rings;
+    {
+        std::lock_guard<std::mutex> rings_lock(rings_mutex_);
+        for (auto& r: rings_) rings.push_back(r.get());
+    }
+    
+    taken_.resize(rings.size());
+    pending_.clear();
+    std::uint64_t drops = retired_drops_;
+    std::vector<log_ring*> retired;
+    
+    for (std::size_t i = 0; i < rings.size(); ++i)
+    {
+        // checked first, a retired ring gets no more records
+        if (rings[i]->retired()) retired.push_back(rings[i]);
+        
+        taken_[i].clear();
+        rings[i]->take(taken_[i]);
+        drops += rings[i]->dropped();
+        
+        for (std::size_t at = 0; at < taken_[i].size(); )
+        {
+            record_head head;
+            std::memcpy(&head, taken_[i].data() + at, sizeof head);
+            pending_.push_back(pending{head.time, taken_[i].data() + at});
+            at += head.size;
+        }
+    }
+    
+    if (!retired.empty())
+    {
+        std::lock_guard<std::mutex> rings_lock(rings_mutex_);
+        for (auto r: retired)
+        {
+            retired_drops_ += r->dropped();
+            rings_.erase(std::find_if(rings_.begin(), rings_.end(),
+                [r](const aligned_ptr<log_ring>& p) { return p.get() == r; }));
+        }
+    }
+    
+    if (took)
+    {
+        *took = !pending_.empty() || !retired.empty();
+    }
+    
+    // each ring is in order already, this interleaves the threads
+    std::stable_sort(pending_.begin(), pending_.end(),
+        [](const pending& a, const pending& b) { return a.time < b.time; });
+    
+    out_.clear();
+    for (auto& p: pending_)
+    {
+        format(p.record);
+    }
+    
+    if (drops != reported_drops_)
+    {
+        auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        stamp(now, log_level::warning);
+        out_ += "log rings full, dropped " + std::to_string(drops - reported_drops_) + " records\n";
+        reported_drops_ = drops;
+    }
+    
+    if (!out_.empty())
+    {
+        std::fwrite(out_.data(), 1, out_.size(), file_);
+        std::fflush(file_);
+    }
+    
+    return true;
+}
+
+// Sleeps until a producer wakes it, unless a ring filled or retired in the
+// meantime.
+void log_sink::wait()
+{
+    idle_.store(true);
+    
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        for (auto& r: rings_)
+        {
+            if (!r->empty() || r->retired())
+            {
+                idle_.store(false);
+                return;
+            }
+        }
+    }
+    
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_.wait(lock, [this]() { return !idle_.load(); });
+}
+
+void log_sink::stamp(std::uint64_t time, log_level level)
+{
+    std::time_t second = time / 1000000000;
+    if (second != second_)
+    {
+        std::tm tm;
+        localtime_r(&second, &tm);
+        std::strftime(clock_, sizeof clock_, "%H:%M:%S", &tm);
+        second_ = second;
+    }
+    
+    static const char levels[] = "DIWE";
+    char micros[16];
+    std::snprintf(micros, sizeof micros, ".%06u %c ", unsigned(time / 1000 % 1000000), levels[int(level)]);
+    
+    out_ += clock_;
+    out_ += micros;
+}
+
+void log_sink::format(const char* record)
+{
+    auto head = read<record_head>(record);
+    stamp(head.time, head.level);
+    
+    auto f = head.format;
+    for (std::size_t i = 0; ; ++i)
+    {
+        auto next = std::strstr(f, "{}");
+        if (!next || i == head.count)
+        {
+            out_ += f;
+            break;
+        }
+        
+        out_.append(f, next - f);
+        f = next + 2;
+        
+        switch (*record++)
+        {
+        case 'i':
+            out_ += std::to_string(read<std::int64_t>(record));
+            break;
+        case 'u':
+            out_ += std::to_string(read<std::uint64_t>(record));
+            break;
+        case 'd':
+            out_ += std::to_string(read<double>(record));
+            break;
+        default:
+            {
+                auto n = read<std::uint32_t>(record);
+                out_.append(record, n);
+                record += n;
+            }
+        }
+    }
+    
+    out_.push_back('\n');
+}
+
+log_sink& sink()
+{
+    static log_sink* s = []()
+    {
+        auto s = new log_sink;
+        std::thread([s]() { s->run(); }).detach();
+        // stops the drain thread too, the file may be closed after this
+        std::atexit([]() { sink().drain(true); });
+        return s;
+    }();
+    
+    return *s;
+}
+
+}
+
+void set_log_level(log_level level)
+{
+    log_threshold.store(std::uint8_t(level), std::memory_order_relaxed);
+}
+
+bool parse_log_level(const char* name, log_level& level)
+{
+    static const char* const names[] = {"debug", "info", "warning", "error", "none"};
+    
+    for (int i = 0; i <= int(log_level::none); ++i)
+    {
+        if (std::strcmp(name, names[i]) == 0)
+        {
+            level = log_level(i);
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void set_log_file(std::FILE* file)
+{
+    sink().set_file(file);
+}
+
+void flush_log()
+{
+    sink().drain();
+}
+
+namespace
+{
+
+// The calling thread's ring, retired when the thread exits.
+struct ring_owner
+{
+    ~ring_owner()
+    {
+        if (ring) sink().retire(ring);
+        ring = nullptr;
+        exited = true;
+    }
+    
+    log_ring* ring = nullptr;
+    bool exited = false;    // records from later destructors are dropped
+};
+
+}
+
+void log_write(log_level level, const char* format, const log_arg* args, std::size_t count)
+{
+    thread_local ring_owner owner;
+    if (!owner.ring)
+    {
+        if (owner.exited) return;
+        owner.ring = sink().attach();
+    }
+    
+    record_head head;
+    head.count = std::min<std::size_t>(count, 255);
+    head.size = record_size(args, head.count);
+    head.level = level;
+    head.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    head.format = format;
+    
+    owner.ring->push(head, args);
+    sink().wake();
+}
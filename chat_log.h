@@ -0,0 +1,108 @@
+#ifndef CHAT_LOG_H
+#define CHAT_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+#include <boost/utility/string_view.hpp>
+
+// Asynchronous log. A call site copies its format pointer and arguments
+// as binary into a ring of the calling thread and returns; a background
+// thread drains the rings every few milliseconds while records come in,
+// formats them in time order and writes them with one flush per pass, and
+// sleeps when the log is quiet. Nothing on the calling thread formats,
+// locks or makes a syscall, but for the first record after a quiet spell,
+// which wakes the drain thread. A record that does not fit a full ring is
+// dropped and counted rather than waited for. A thread's ring is freed
+// once the thread exited and the ring was drained.
+//
+//   LOG_INFO("room {} created by {}", id, host);
+//
+// `{}` takes the next argument; integers, doubles and strings are
+// supported, strings are copied. The format must be a literal, only its
+// address is recorded. LOG_DEBUG sites compile to nothing unless built
+// with CHAT_DEBUG_LOG.
+
+enum class log_level : std::uint8_t
+{
+    debug,
+    info,
+    warning,
+    error,
+    none
+};
+
+// Records below the level are skipped at the call site, default info.
+void set_log_level(log_level level);
+
+// "debug", "info", "warning", "error" or "none".
+bool parse_log_level(const char* name, log_level& level);
+
+// Where the drain thread writes, stdout unless set before the first record.
+void set_log_file(std::FILE* file);
+
+// Writes out everything logged so far; also runs at exit.
+void flush_log();
+
+extern std::atomic<std::uint8_t> log_threshold;
+
+inline bool log_enabled(log_level level)
+{
+    return std::uint8_t(level) >= log_threshold.load(std::memory_order_relaxed);
+}
+
+// One argument as passed to log_write(); strings are only referenced.
+struct log_arg
+{
+    log_arg() : tag(0) {}
+    
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+    log_arg(T v) : tag('i') { i = v; }
+    
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, int>::type = 0>
+    log_arg(T v) : tag('u') { u = v; }
+    
+    log_arg(double v) : tag('d') { d = v; }
+    
+    log_arg(boost::string_view v) : tag('s'), s(v) {}
+    log_arg(const std::string& v) : tag('s'), s(v) {}
+    log_arg(const char* v) : tag('s'), s(v) {}
+    
+    char tag;
+    union
+    {
+        std::int64_t i;
+        std::uint64_t u;
+        double d;
+    };
+    
+    boost::string_view s;
+};
+
+void log_write(log_level level, const char* format, const log_arg* args, std::size_t count);
+
+template <std::size_t N, typename... Args>
+void log_message(log_level level, const char (&format)[N], const Args&... args)
+{
+    // one more so the array is never empty
+    const log_arg list[] = {log_arg(args)..., log_arg()};
+    log_write(level, format, list, sizeof...(Args));
+}
+
+#define CHAT_LOG(level, ...) \
+    do { if (log_enabled(level)) log_message(level, __VA_ARGS__); } while (0)
+
+#ifdef CHAT_DEBUG_LOG
+#define LOG_DEBUG(...) CHAT_LOG(log_level::debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+#define LOG_INFO(...) CHAT_LOG(log_level::info, __VA_ARGS__)
+#define LOG_WARNING(...) CHAT_LOG(log_level::warning, __VA_ARGS__)
+#define LOG_ERROR(...) CHAT_LOG(log_level::error, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef CHAT_SEGMENTS_H
+#define CHAT_SEGMENTS_H
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/utility/string_view.hpp>
+
+struct segment
+{
+    static constexpr std::size_t capacity = 4096;
+    
+    segment* next{nullptr};
+    std::size_t size{0};
+    char data[capacity];
+};
+
+// Process wide free list, so a warm pool hands out segments without going
+// to the allocator. Keeps at most max_free of them around.
+class segment_pool
+{
+public:
+    static constexpr std::size_t max_free = 256;
+    
+    static segment_pool& instance()
+    {
+        static segment_pool pool;
+        return pool;
+    }
+    
+    ~segment_pool()
+    {
+        while (free_)
+        {
+            auto s = free_;
+            free_ = s->next;
+            delete s;
+        }
+    }
+    
+    segment* acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            
+            if (free_)
+            {
+                auto s = free_;
+                free_ = s->next;
+                --count_;
+                
+                s->next = nullptr;
+                s->size = 0;
+                return s;
+            }
+        }
+        
+        return new segment;
+    }
+    
+    // takes back a whole chain linked through `next`
+    void release(segment* s)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        
+        while (s && count_ < max_free)
+        {
+            auto next = s->next;
+            s->next = free_;
+            free_ = s;
+            ++count_;
+            s = next;
+        }
+        
+        lock.unlock();
+        
+        while (s)
+        {
+            auto next = s->next;
+            delete s;
+            s = next;
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    segment* free_{nullptr};
+    std::size_t count_{0};
+};
+
+// Bytes kept in a list of pooled segments instead of one contiguous block.
+// Written either by append() or by reading into prepare() and commit(),
+// sent with gather I/O through buffers().
+class segment_chain
+{
+public:
+    segment_chain() = default;
+    
+    segment_chain(const segment_chain& other)
+    {
+        other.for_each([this](boost::string_view part) { append(part); });
+    }
+    
+    segment_chain(segment_chain&& other) noexcept
+    {
+        swap(other);
+    }
+    
+    segment_chain& operator=(segment_chain other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+    
+    ~segment_chain()
+    {
+        clear();
+    }
+    
+    void swap(segment_chain& other) noexcept
+    {
+        std::swap(head_, other.head_);
+        std::swap(tail_, other.tail_);
+        std::swap(size_, other.size_);
+    }
+    
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    
+    void clear()
+    {
+        segment_pool::instance().release(head_);
+        head_ = tail_ = nullptr;
+        size_ = 0;
+    }
+    
+    void append(const char* p, std::size_t n)
+    {
+        while (n > 0)
+        {
+            grow();
+            
+            auto k = std::min(n, segment::capacity - tail_->size);
+            std::memcpy(tail_->data + tail_->size, p, k);
+            
+            tail_->size += k;
+            size_ += k;
+            p += k;
+            n -= k;
+        }
+    }
+    
+    void append(boost::string_view s) { append(s.data(), s.size()); }
+    
+    // Scatter list covering the next `n` bytes; commit() what was read.
+    std::vector<boost::asio::mutable_buffer> prepare(std::size_t n)
+    {
+        std::vector<boost::asio::mutable_buffer> out;
+        
+        if (!tail_)
+        {
+            head_ = tail_ = segment_pool::instance().acquire();
+        }
+        
+        for (auto s = tail_; n > 0; s = s->next)
+        {
+            auto k = std::min(n, segment::capacity - s->size);
+            if (k > 0)
+            {
+                out.emplace_back(s->data + s->size, k);
+                n -= k;
+            }
+            
+            if (n > 0 && !s->next)
+            {
+                s->next = segment_pool::instance().acquire();
+            }
+        }
+        
+        return out;
+    }
+    
+    void commit(std::size_t n)
+    {
+        while (n > 0)
+        {
+            grow();
+            
+            auto k = std::min(n, segment::capacity - tail_->size);
+            tail_->size += k;
+            size_ += k;
+            n -= k;
+        }
+    }
+    
+    // Replaces bytes already in the chain, a header field say. False if
+    // they are not all there.
+    bool overwrite(std::size_t pos, const char* p, std::size_t n)
+    {
+        if (pos + n > size_)
+        {
+            return false;
+        }
+        
+        for (auto s = head_; n > 0; s = s->next)
+        {
+            if (pos >= s->size)
+            {
+                pos -= s->size;
+                continue;
+            }
+            
+            auto k = std::min(n, s->size - pos);
+            std::memcpy(s->data + pos, p, k);
+            p += k;
+            n -= k;
+            pos = 0;
+        }
+        
+        return true;
+    }
+    
+    // Copies `n` bytes from `pos` to `p`, false if they are not all there.
+    bool copy(std::size_t pos, char* p, std::size_t n) const
+    {
+        if (pos + n > size_)
+        {
+            return false;
+        }
+        
+        for (auto s = head_; n > 0; s = s->next)
+        {
+            if (pos >= s->size)
+            {
+                pos -= s->size;
+                continue;
+            }
+            
+            auto k = std::min(n, s->size - pos);
+            std::memcpy(p, s->data + pos, k);
+            p += k;
+            n -= k;
+            pos = 0;
+        }
+        
+        return true;
+    }
+    
+    // the first segment, which holds at least the first 4 KiB
+    boost::string_view front() const
+    {
+        return head_ ? boost::string_view(head_->data, head_->size) : boost::string_view();
+    }
+    
+    // calls f(boost::string_view) for every filled segment, in order
+    template <typename F>
+    void for_each(F f) const
+    {
+        for (auto s = head_; s && s->size > 0; s = s->next)
+        {
+            f(boost::string_view(s->data, s->size));
+        }
+    }
+    
+    std::vector<boost::asio::const_buffer> buffers() const
+    {
+        std::vector<boost::asio::const_buffer> out;
+        for_each([&out](boost::string_view part) { out.emplace_back(part.data(), part.size()); });
+        return out;
+    }
+
+private:
+    // makes tail_ a segment with room left, reusing one left by prepare()
+    void grow()
+    {
+        if (!tail_)
+        {
+            head_ = tail_ = segment_pool::instance().acquire();
+        }
+        else if (tail_->size == segment::capacity)
+        {
+            if (!tail_->next)
+            {
+                tail_->next = segment_pool::instance().acquire();
+            }
+            
+            tail_ = tail_->next;
+        }
+    }
+    
+    segment* head_{nullptr};
+    segment* tail_{nullptr};
+    std::size_t size_{0};
+};
+
+#endif
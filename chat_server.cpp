@@ -1,5 +1,8 @@
 
 
+#include <sstream>
+
+#include "chat_log.h"
 #include "chat_server.h"
 
 void chat_server::do_accept()
@@ -9,43 +12,36 @@ void chat_server::do_accept()
         {
             if (!ec)
             {
-                std::cout << "new user accepted" << std::endl;
-                std::make_shared<server_session>(std::move(socket_), rooms_)->start();
+                metrics_.accepted();
+                LOG_INFO("new user accepted");
+                std::make_shared<server_session>(std::move(socket_), rooms_, metrics_)->start();
+            }
+            else
+            {
+                metrics_.accept_failed();
+                LOG_WARNING("accept failed: {}", ec.message());
             }
 
             do_accept();
         });
 }
 
-int main(int argc, char* argv[])
+void admin_server::do_accept()
 {
-    try
-    {
-        if (argc < 2)
+    acceptor_.async_accept(socket_,
+        [this](boost::system::error_code ec)
         {
-            std::cerr << "Usage: chat_server <port> [<port> ...]\n";
-            return 1;
-        }
-
-        boost::asio::io_service io;
-
-//         std::list<chat_server> servers;
-//         for (int i = 1; i < argc; ++i)
-//         {
-//         tcp::endpoint endpoint(tcp::v4(), std::atoi(argv[i]));
-//         servers.emplace_back(io_service, endpoint);
-//         }
-        
-        tcp::endpoint endpoint(tcp::v4(), std::atoi(argv[1]));
-        
-        chat_server server(io, endpoint);
+            if (!ec)
+            {
+                std::ostringstream os;
+                metrics_.report(os, rooms_.size());
+                
+                auto socket = std::make_shared<tcp::socket>(std::move(socket_));
+                auto text = std::make_shared<std::string>(os.str());
+                boost::asio::async_write(*socket, boost::asio::buffer(*text),
+                    [socket, text](boost::system::error_code, std::size_t) {});
+            }
 
-        io.run();
-    }
-    catch (std::exception& e)
-    {
-        std::cerr << "Exception: " << e.what() << "\n";
-    }
-    
-    return 0;
+            do_accept();
+        });
 }
@@ -1,74 +1,133 @@
 
+#ifndef CHAT_SERVER_H
+#define CHAT_SERVER_H
+
 #include <string>
-#include <map>
-#include <queue>
+#include <utility>
+#include <vector>
 
 #include <boost/asio.hpp>
 
 #include "chat_structures.h"
+#include "chat_binary.h"
+#include "handler_alloc.h"
+#include "room_registry.h"
+#include "server_metrics.h"
 
 using boost::asio::ip::tcp;
 
-struct history_entry
-{
-    std::string from;
-    std::string message;
-};
-
-struct chat_room
-{
-    std::string id;
-    std::string host_id;
-    host_info host;
-    std::queue<history_entry> history_;
-};
-
-typedef std::map<std::string, chat_room> room_map;
-
 class server_session :
     public std::enable_shared_from_this<server_session>
 {
 public:
-    
-    server_session(tcp::socket socket, room_map& rooms) :
+
+    server_session(tcp::socket socket, room_registry& rooms, server_metrics& metrics) :
         socket_(std::move(socket)),
-        rooms_ (rooms)
-    {}
+        rooms_ (rooms),
+        metrics_(metrics)
+    {
+        metrics_.session_opened();
+    }
+    
+    ~server_session()
+    {
+        metrics_.session_closed();
+    }
     
     void start()
     {
         do_read();
     }
-    
+
 protected:
     void do_read();
     void do_write();
     
+    // Answers go out in the format of the request: binary if `request`
+    // points to the header of a binary frame, text otherwise.
+    bool handle(boost::string_view frame);
+    template <typename Response>
+    bool reply(const Response& res, const binary_header* request);
+    
+    const connect_res& lookup(const connect_req_view& req);
+    connect_batch_res lookup(const connect_batch_req& batch);
+    bool renew(const heartbeat& hb);
+    bool succession(const standby& sb);
+    
+    void close();
+
 private:
     tcp::socket socket_;
     
-    buffer_t buf_;
-    room_map& rooms_;
-    std::string id_;
+    // Requests are answered in order; everything answered from one read
+    // goes out in a single write before the next read is started. The
+    // frame size bounds a connect-batch-req to a few hundred rooms.
+    stream_buffer<8192> in_;
+    std::string out_;
+    
+    // a read and the write after it never overlap, they share one block
+    handler_memory io_memory_;
     
-    enum { accept_request, accept_info, close_connection } state_{accept_request};
+    room_registry& rooms_;
+    server_metrics& metrics_;
+    
+    std::string key_;
+    room_entry room_;
+    connect_res res_;
+    std::vector<room_lookup> lookups_;
+    
+    // rooms hosted over this connection, dropped when it closes
+    std::vector<std::pair<std::string, std::string>> hosted_;
 };
 
 struct chat_server
 {
     chat_server(boost::asio::io_service& io_service,
-        const tcp::endpoint& endpoint) : 
+        const tcp::endpoint& endpoint, room_registry& rooms, server_metrics& metrics) : 
+      acceptor_(io_service, endpoint),
+      socket_(io_service),
+      rooms_(rooms),
+      metrics_(metrics)
+    {
+        do_accept();
+    }
+    
+    void do_accept();
+    
+    tcp::endpoint local_endpoint() const { return acceptor_.local_endpoint(); }
+
+private:
+    tcp::acceptor acceptor_;
+    tcp::socket socket_;
+    
+    room_registry& rooms_;
+    server_metrics& metrics_;
+};
+
+// Answers every connection with the metrics report and closes it, so
+// `nc <host> <port>` is a scrape. Kept off the lookup ports.
+struct admin_server
+{
+    admin_server(boost::asio::io_service& io_service,
+        const tcp::endpoint& endpoint, const room_registry& rooms, server_metrics& metrics) : 
       acceptor_(io_service, endpoint),
-      socket_(io_service)
+      socket_(io_service),
+      rooms_(rooms),
+      metrics_(metrics)
     {
         do_accept();
     }
     
     void do_accept();
     
+    tcp::endpoint local_endpoint() const { return acceptor_.local_endpoint(); }
+
 private:
     tcp::acceptor acceptor_;
     tcp::socket socket_;
     
-    room_map rooms_;
-};
\ No newline at end of file
+    const room_registry& rooms_;
+    server_metrics& metrics_;
+};
+
+#endif
\ No newline at end of file
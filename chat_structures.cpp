@@ -41,10 +41,71 @@ BOOST_FUSION_ADAPT_STRUCT (
     (host_info_opt, host)
 )
 
+BOOST_FUSION_ADAPT_STRUCT (
+    connect_batch_req,
+    (std::string, from)
+    (std::vector<std::string>, rooms)
+    (host_info, host)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    room_host,
+    (std::string, room)
+    (std::string, host_id)
+    (host_info_opt, host)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    connect_batch_res,
+    (int, status)
+    (std::vector<room_host>, rooms)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    heartbeat,
+    (std::string, from)
+    (std::string, room)
+    (host_info, host)
+)
+
 BOOST_FUSION_ADAPT_STRUCT (
     message,
     (std::string, from)
     (std::string, body)
+    (std::uint32_t, seq)
+    (boost::optional<std::uint64_t>, sent)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    join,
+    (std::string, from)
+    (host_info, host)
+    (std::uint32_t, after)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    successor,
+    (std::string, id)
+    (host_info, host)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    standby,
+    (std::string, from)
+    (std::string, room)
+    (std::vector<successor>, successors)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    redirect,
+    (std::string, from)
+    (successor, to)
+)
+
+BOOST_FUSION_ADAPT_STRUCT (
+    subtree,
+    (std::string, from)
+    (std::uint32_t, size)
 )
 
 template <template <typename> class Generator, typename T, typename Buffer>
@@ -71,7 +132,7 @@ struct connect_req_gen : karma::grammar<Iterator, connect_req()>
         id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
         host_ (
             karma::lit("{\"address\":\"") << karma::string << "\","
-            << "\"port\":" << karma::short_ << '}'
+            << "\"port\":" << karma::ushort_ << '}'
         ),
         pdu_ (
             karma::lit("connect-req:{")
@@ -92,7 +153,7 @@ struct connect_res_gen : karma::grammar<Iterator, connect_res()>
         host_ (
             -(karma::lit(",\"host\":") 
                 << karma::lit("{\"address\":\"") << karma::string << "\","
-                << "\"port\":" << karma::short_ << '}')
+                << "\"port\":" << karma::ushort_ << '}')
         ),
         pdu_ (
             karma::lit("connect-res:{")
@@ -104,6 +165,81 @@ struct connect_res_gen : karma::grammar<Iterator, connect_res()>
     {}
 };
 
+template <typename Iterator>
+struct connect_batch_req_gen : karma::grammar<Iterator, connect_batch_req()>
+{
+    using rule_str_t = karma::rule<Iterator, std::string()>;
+    
+    rule_str_t id_;
+    karma::rule<Iterator, host_info()> host_;
+    karma::rule<Iterator, connect_batch_req()> pdu_;
+    
+    connect_batch_req_gen() : connect_batch_req_gen::base_type(pdu_),
+        id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
+        host_ (
+            karma::lit("{\"address\":\"") << karma::string << "\","
+            << "\"port\":" << karma::ushort_ << '}'
+        ),
+        pdu_ (
+            karma::lit("connect-batch-req:{")
+            << karma::lit("\"from\":\"") << id_ << "\","
+            << karma::lit("\"rooms\":[") << (('"' << id_ << '"') % ',') << "],"
+            << karma::lit("\"host\":") << host_ << '}'
+        )
+    {}
+};
+
+template <typename Iterator>
+struct connect_batch_res_gen : karma::grammar<Iterator, connect_batch_res()>
+{
+    using rule_str_t = karma::rule<Iterator, std::string()>;
+    
+    rule_str_t id_;
+    karma::rule<Iterator, room_host()> room_;
+    karma::rule<Iterator, connect_batch_res()> pdu_;
+    
+    connect_batch_res_gen() : connect_batch_res_gen::base_type(pdu_),
+        id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
+        room_ (
+            karma::lit("{\"room\":\"") << id_ << "\","
+            << "\"host_id\":\"" << id_ << '"'
+            << -(karma::lit(",\"host\":") 
+                << karma::lit("{\"address\":\"") << karma::string << "\","
+                << "\"port\":" << karma::ushort_ << '}')
+            << '}'
+        ),
+        pdu_ (
+            karma::lit("connect-batch-res:{")
+            << karma::lit("\"status\":") << karma::int_ << ','
+            << karma::lit("\"rooms\":[") << (room_ % ',') << "]}"
+        )
+    {}
+};
+
+template <typename Iterator>
+struct heartbeat_gen : karma::grammar<Iterator, heartbeat()>
+{
+    using rule_str_t = karma::rule<Iterator, std::string()>;
+    
+    rule_str_t id_;
+    karma::rule<Iterator, host_info()> host_;
+    karma::rule<Iterator, heartbeat()> pdu_;
+    
+    heartbeat_gen() : heartbeat_gen::base_type(pdu_),
+        id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
+        host_ (
+            karma::lit("{\"address\":\"") << karma::string << "\","
+            << "\"port\":" << karma::ushort_ << '}'
+        ),
+        pdu_ (
+            karma::lit("heartbeat:{")
+            << karma::lit("\"from\":\"") << id_ << "\","
+            << karma::lit("\"room\":\"") << id_ << "\","
+            << karma::lit("\"host\":") << host_ << '}'
+        )
+    {}
+};
+
 template <typename Iterator>
 struct message_gen : karma::grammar<Iterator, message()>
 {
@@ -123,7 +259,107 @@ struct message_gen : karma::grammar<Iterator, message()>
             karma::lit("message") << ':' << '{'
             << karma::lit("from:\"") << id_ << "\","
             //<< karma::lit("\"to\":\"") << id_ << "\","
-            << body_ << '}'
+            << body_ << ",seq:" << karma::right_align(message_seq_digits, karma::lit('0')) [ karma::uint_ ]
+            << -(karma::lit(",sent:") << karma::uint_generator<std::uint64_t>()) << '}'
+        )
+    {}
+};
+
+template <typename Iterator>
+struct join_gen : karma::grammar<Iterator, join()>
+{
+    using rule_str_t = karma::rule<Iterator, std::string()>;
+    
+    rule_str_t id_;
+    karma::rule<Iterator, host_info()> host_;
+    karma::rule<Iterator, join()> pdu_;
+    
+    join_gen() : join_gen::base_type(pdu_),
+        id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
+        host_ (
+            karma::lit("{\"address\":\"") << karma::string << "\","
+            << "\"port\":" << karma::ushort_ << '}'
+        ),
+        pdu_ (
+            karma::lit("join:{")
+            << karma::lit("\"from\":\"") << id_ << "\","
+            << karma::lit("\"host\":") << host_ << ','
+            << karma::lit("\"after\":") << karma::uint_ << '}'
+        )
+    {}
+};
+
+template <typename Iterator>
+struct standby_gen : karma::grammar<Iterator, standby()>
+{
+    using rule_str_t = karma::rule<Iterator, std::string()>;
+    
+    rule_str_t id_;
+    karma::rule<Iterator, host_info()> host_;
+    karma::rule<Iterator, successor()> successor_;
+    karma::rule<Iterator, standby()> pdu_;
+    
+    standby_gen() : standby_gen::base_type(pdu_),
+        id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
+        host_ (
+            karma::lit("{\"address\":\"") << karma::string << "\","
+            << "\"port\":" << karma::ushort_ << '}'
+        ),
+        successor_ (
+            karma::lit("{\"id\":\"") << id_ << "\","
+            << "\"host\":" << host_ << '}'
+        ),
+        pdu_ (
+            karma::lit("standby:{")
+            << karma::lit("\"from\":\"") << id_ << "\","
+            << karma::lit("\"room\":\"") << id_ << "\","
+            << karma::lit("\"successors\":[") << -(successor_ % ',') << "]}"
+        )
+    {}
+};
+
+template <typename Iterator>
+struct redirect_gen : karma::grammar<Iterator, redirect()>
+{
+    using rule_str_t = karma::rule<Iterator, std::string()>;
+    
+    rule_str_t id_;
+    karma::rule<Iterator, host_info()> host_;
+    karma::rule<Iterator, successor()> to_;
+    karma::rule<Iterator, redirect()> pdu_;
+    
+    redirect_gen() : redirect_gen::base_type(pdu_),
+        id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
+        host_ (
+            karma::lit("{\"address\":\"") << karma::string << "\","
+            << "\"port\":" << karma::ushort_ << '}'
+        ),
+        to_ (
+            karma::lit("{\"id\":\"") << id_ << "\","
+            << "\"host\":" << host_ << '}'
+        ),
+        pdu_ (
+            karma::lit("redirect:{")
+            << karma::lit("\"from\":\"") << id_ << "\","
+            << karma::lit("\"to\":") << to_ << '}'
+        )
+    {}
+};
+
+template <typename Iterator>
+struct subtree_gen : karma::grammar<Iterator, subtree()>
+{
+    using rule_str_t = karma::rule<Iterator, std::string()>;
+    
+    rule_str_t id_;
+    karma::rule<Iterator, subtree()> pdu_;
+    
+    subtree_gen() : subtree_gen::base_type(pdu_),
+        id_ (karma::repeat(1, 16) [karma::char_("0-9a-zA-Z@.")]),
+        pdu_ (
+            karma::lit("subtree:{")
+            << karma::lit("\"from\":\"") << id_ << "\","
+            << karma::lit("\"size\":") << karma::uint_ << '}'
         )
     {}
 };
@@ -154,7 +390,7 @@ struct connect_req_gram : qi::grammar<Iterator, connect_req(), Skipper>
         address_ (qi::repeat(4, 64) [qi::char_("0-9a-zA-Z@.")]),
         host_ (
             qi::char_('{') >> "\"address\"" >> ':' >> '"' >> address_ [phoenix::at_c<0>(qi::_val) = qi::_1] >> '"' >> ','
-            >> qi::lit("\"port\"") >> ':' >> qi::short_ [ phoenix::at_c<1>(qi::_val) = qi::_1 ] >> '}'
+            >> qi::lit("\"port\"") >> ':' >> qi::ushort_ [ phoenix::at_c<1>(qi::_val) = qi::_1 ] >> '}'
         ),
         pdu_ (
             qi::lit("connect-req") >> ':' >> '{'
@@ -179,7 +415,7 @@ struct connect_res_gram : qi::grammar<Iterator, connect_res(), Skipper>
         host_ (
                 qi::lit("\"host\"") >> ':' 
                 >> '{' >> "\"address\"" >> ':' >> '"' >> address_ >> '"' >> ','
-                >> "\"port\"" >> ':' >> qi::short_ >> '}'
+                >> "\"port\"" >> ':' >> qi::ushort_ >> '}'
         ),
         pdu_ (
             qi::lit("connect-res") >> ':' >> '{'
@@ -191,6 +427,87 @@ struct connect_res_gram : qi::grammar<Iterator, connect_res(), Skipper>
     {}
 };
 
+template <typename Iterator, typename Skipper>
+struct connect_batch_req_gram : qi::grammar<Iterator, connect_batch_req(), Skipper>
+{
+    qi::rule<Iterator, std::string()> id_;
+    qi::rule<Iterator, std::string()> address_;
+    qi::rule<Iterator, std::vector<std::string>(), Skipper> rooms_;
+    qi::rule<Iterator, host_info(), Skipper> host_;
+    qi::rule<Iterator, connect_batch_req(), Skipper> pdu_;
+    
+    connect_batch_req_gram() : connect_batch_req_gram::base_type(pdu_),
+        id_ (qi::repeat(1, 16) [qi::char_("0-9a-zA-Z@.")]),
+        address_ (qi::repeat(4, 64) [qi::char_("0-9a-zA-Z@.")]),
+        rooms_ ('[' >> (('"' >> id_ >> '"') % ',') >> ']'),
+        host_ (
+            '{' >> qi::lit("\"address\"") >> ':' >> '"' >> address_ >> '"' >> ','
+            >> "\"port\"" >> ':' >> qi::ushort_ >> '}'
+        ),
+        pdu_ (
+            qi::lit("connect-batch-req") >> ':' >> '{'
+            >> qi::lit("\"from\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> qi::lit("\"rooms\"") >> ':' >> rooms_ >> ','
+            >> qi::lit("\"host\"") >> ':' >> host_ >> '}'
+        )
+    {}
+};
+
+template <typename Iterator, typename Skipper>
+struct connect_batch_res_gram : qi::grammar<Iterator, connect_batch_res(), Skipper>
+{
+    qi::rule<Iterator, std::string()> id_;
+    qi::rule<Iterator, std::string()> address_;
+    qi::rule<Iterator, host_info(), Skipper> host_;
+    qi::rule<Iterator, room_host(), Skipper> room_;
+    qi::rule<Iterator, connect_batch_res(), Skipper> pdu_;
+    
+    connect_batch_res_gram() : connect_batch_res_gram::base_type(pdu_),
+        id_ (qi::repeat(1, 16) [qi::char_("0-9a-zA-Z@.")]),
+        address_ (qi::repeat(4, 64) [qi::char_("0-9a-zA-Z@.")]),
+        host_ (
+            '{' >> qi::lit("\"address\"") >> ':' >> '"' >> address_ >> '"' >> ','
+            >> "\"port\"" >> ':' >> qi::ushort_ >> '}'
+        ),
+        room_ (
+            '{' >> qi::lit("\"room\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> "\"host_id\"" >> ':' >> '"' >> id_ >> '"'
+            >> -(',' >> qi::lit("\"host\"") >> ':' >> host_)
+            >> '}'
+        ),
+        pdu_ (
+            qi::lit("connect-batch-res") >> ':' >> '{'
+            >> "\"status\"" >> ':' >> qi::int_ >> ','
+            >> "\"rooms\"" >> ':' >> '[' >> (room_ % ',') >> ']'
+            >> '}'
+        )
+    {}
+};
+
+template <typename Iterator, typename Skipper>
+struct heartbeat_gram : qi::grammar<Iterator, heartbeat(), Skipper>
+{
+    qi::rule<Iterator, std::string()> id_;
+    qi::rule<Iterator, std::string()> address_;
+    qi::rule<Iterator, host_info()> host_;
+    qi::rule<Iterator, heartbeat(), Skipper> pdu_;
+    
+    heartbeat_gram() : heartbeat_gram::base_type(pdu_),
+        id_ (qi::repeat(1, 16) [qi::char_("0-9a-zA-Z@.")]),
+        address_ (qi::repeat(4, 64) [qi::char_("0-9a-zA-Z@.")]),
+        host_ (
+            qi::char_('{') >> "\"address\"" >> ':' >> '"' >> address_ [phoenix::at_c<0>(qi::_val) = qi::_1] >> '"' >> ','
+            >> qi::lit("\"port\"") >> ':' >> qi::ushort_ [ phoenix::at_c<1>(qi::_val) = qi::_1 ] >> '}'
+        ),
+        pdu_ (
+            qi::lit("heartbeat") >> ':' >> '{'
+            >> qi::lit("\"from\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> qi::lit("\"room\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> qi::lit("\"host\"") >> ':' >> host_ >> '}'
+        )   
+    {}
+};
+
 template <typename Iterator, typename Skipper>
 struct message_gram : qi::grammar<Iterator, message(), Skipper>
 {
@@ -212,37 +529,218 @@ struct message_gram : qi::grammar<Iterator, message(), Skipper>
             qi::lit("message") >> ':' >> '{'
             >> qi::lit("from") >> ':' >> '"' >> id_ >> '"' >> ','
             //>> qi::lit("\"to\"") >> ':' >> '"' >> id_ >> '"' >> ','
-            >> body_ >> '}'
+            >> body_ >> ',' >> "seq" >> ':' >> qi::uint_
+            >> -(qi::lit(',') >> "sent" >> ':' >> qi::uint_parser<std::uint64_t>()) >> '}'
         )
     {}
 };
+
+template <typename Iterator, typename Skipper>
+struct join_gram : qi::grammar<Iterator, join(), Skipper>
+{
+    qi::rule<Iterator, std::string()> id_;
+    qi::rule<Iterator, std::string()> address_;
+    qi::rule<Iterator, host_info(), Skipper> host_;
+    qi::rule<Iterator, join(), Skipper> pdu_;
     
+    join_gram() : join_gram::base_type(pdu_),
+        id_ (qi::repeat(1, 16) [qi::char_("0-9a-zA-Z@.")]),
+        address_ (qi::repeat(4, 64) [qi::char_("0-9a-zA-Z@.")]),
+        host_ (
+            '{' >> qi::lit("\"address\"") >> ':' >> '"' >> address_ >> '"' >> ','
+            >> "\"port\"" >> ':' >> qi::ushort_ >> '}'
+        ),
+        pdu_ (
+            qi::lit("join") >> ':' >> '{'
+            >> qi::lit("\"from\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> qi::lit("\"host\"") >> ':' >> host_ >> ','
+            >> qi::lit("\"after\"") >> ':' >> qi::uint_ >> '}'
+        )
+    {}
+};
+
+template <typename Iterator, typename Skipper>
+struct standby_gram : qi::grammar<Iterator, standby(), Skipper>
+{
+    qi::rule<Iterator, std::string()> id_;
+    qi::rule<Iterator, std::string()> address_;
+    qi::rule<Iterator, host_info(), Skipper> host_;
+    qi::rule<Iterator, successor(), Skipper> successor_;
+    qi::rule<Iterator, standby(), Skipper> pdu_;
+    
+    standby_gram() : standby_gram::base_type(pdu_),
+        id_ (qi::repeat(1, 16) [qi::char_("0-9a-zA-Z@.")]),
+        address_ (qi::repeat(4, 64) [qi::char_("0-9a-zA-Z@.")]),
+        host_ (
+            '{' >> qi::lit("\"address\"") >> ':' >> '"' >> address_ >> '"' >> ','
+            >> "\"port\"" >> ':' >> qi::ushort_ >> '}'
+        ),
+        successor_ (
+            '{' >> qi::lit("\"id\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> "\"host\"" >> ':' >> host_ >> '}'
+        ),
+        pdu_ (
+            qi::lit("standby") >> ':' >> '{'
+            >> qi::lit("\"from\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> qi::lit("\"room\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> "\"successors\"" >> ':' >> '[' >> -(successor_ % ',') >> ']'
+            >> '}'
+        )
+    {}
+};
+
+template <typename Iterator, typename Skipper>
+struct redirect_gram : qi::grammar<Iterator, redirect(), Skipper>
+{
+    qi::rule<Iterator, std::string()> id_;
+    qi::rule<Iterator, std::string()> address_;
+    qi::rule<Iterator, host_info(), Skipper> host_;
+    qi::rule<Iterator, successor(), Skipper> to_;
+    qi::rule<Iterator, redirect(), Skipper> pdu_;
+    
+    redirect_gram() : redirect_gram::base_type(pdu_),
+        id_ (qi::repeat(1, 16) [qi::char_("0-9a-zA-Z@.")]),
+        address_ (qi::repeat(4, 64) [qi::char_("0-9a-zA-Z@.")]),
+        host_ (
+            '{' >> qi::lit("\"address\"") >> ':' >> '"' >> address_ >> '"' >> ','
+            >> "\"port\"" >> ':' >> qi::ushort_ >> '}'
+        ),
+        to_ (
+            '{' >> qi::lit("\"id\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> "\"host\"" >> ':' >> host_ >> '}'
+        ),
+        pdu_ (
+            qi::lit("redirect") >> ':' >> '{'
+            >> qi::lit("\"from\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> qi::lit("\"to\"") >> ':' >> to_ >> '}'
+        )
+    {}
+};
+
+template <typename Iterator, typename Skipper>
+struct subtree_gram : qi::grammar<Iterator, subtree(), Skipper>
+{
+    qi::rule<Iterator, std::string()> id_;
+    qi::rule<Iterator, subtree(), Skipper> pdu_;
+    
+    subtree_gram() : subtree_gram::base_type(pdu_),
+        id_ (qi::repeat(1, 16) [qi::char_("0-9a-zA-Z@.")]),
+        pdu_ (
+            qi::lit("subtree") >> ':' >> '{'
+            >> qi::lit("\"from\"") >> ':' >> '"' >> id_ >> '"' >> ','
+            >> qi::lit("\"size\"") >> ':' >> qi::uint_ >> '}'
+        )
+    {}
+};
+
 bool encode_connection_req(const connect_req& msg, buffer_t& buf)
 {
     return encode<connect_req_gen>(msg, buf);
 }
 
+bool encode_connection_req(const connect_req& msg, std::string& buf)
+{
+    return encode<connect_req_gen>(msg, buf);
+}
+
 bool encode_connection_res(const connect_res& msg, buffer_t& buf)
 {
     return encode<connect_res_gen>(msg, buf);
 }
 
+bool encode_connection_res(const connect_res& msg, std::string& buf)
+{
+    return encode<connect_res_gen>(msg, buf);
+}
+
+bool encode_connect_batch_req(const connect_batch_req& msg, std::string& buf)
+{
+    return encode<connect_batch_req_gen>(msg, buf);
+}
+
+bool encode_connect_batch_res(const connect_batch_res& msg, std::string& buf)
+{
+    return encode<connect_batch_res_gen>(msg, buf);
+}
+
 bool encode_message(const message& msg, buffer_t& buf)
 {
     return encode<message_gen>(msg, buf);
 }
 
-bool decode_connect_req(const buffer_t& buf, connect_req& msg)
+bool encode_heartbeat(const heartbeat& msg, buffer_t& buf)
 {
-    return decode<connect_req_gram>(buf, msg);  
+    return encode<heartbeat_gen>(msg, buf);
 }
 
-bool decode_connect_res(const buffer_t& buf, connect_res& msg)
+bool encode_join(const join& msg, std::string& buf)
 {
-    return decode<connect_res_gram>(buf, msg);
+    return encode<join_gen>(msg, buf);
 }
 
-bool decode_message(const buffer_t& buf, message& msg)
+bool encode_standby(const standby& msg, std::string& buf)
 {
-    return decode<message_gram>(buf, msg);
-}
\ No newline at end of file
+    return encode<standby_gen>(msg, buf);
+}
+
+bool encode_redirect(const redirect& msg, std::string& buf)
+{
+    return encode<redirect_gen>(msg, buf);
+}
+
+bool encode_subtree(const subtree& msg, std::string& buf)
+{
+    return encode<subtree_gen>(msg, buf);
+}
+
+bool decode_connect_req(boost::string_view frame, connect_req& msg)
+{
+    return decode<connect_req_gram>(frame, msg);  
+}
+
+bool decode_connect_res(boost::string_view frame, connect_res& msg)
+{
+    return decode<connect_res_gram>(frame, msg);
+}
+
+bool decode_connect_batch_req(boost::string_view frame, connect_batch_req& msg)
+{
+    return decode<connect_batch_req_gram>(frame, msg);
+}
+
+bool decode_connect_batch_res(boost::string_view frame, connect_batch_res& msg)
+{
+    return decode<connect_batch_res_gram>(frame, msg);
+}
+
+bool decode_message(boost::string_view frame, message& msg)
+{
+    return decode<message_gram>(frame, msg);
+}
+
+bool decode_heartbeat(boost::string_view frame, heartbeat& msg)
+{
+    return decode<heartbeat_gram>(frame, msg);
+}
+
+bool decode_join(boost::string_view frame, join& msg)
+{
+    return decode<join_gram>(frame, msg);
+}
+
+bool decode_standby(boost::string_view frame, standby& msg)
+{
+    // qi appends to containers
+    msg.successors.clear();
+    return decode<standby_gram>(frame, msg);
+}
+
+bool decode_redirect(boost::string_view frame, redirect& msg)
+{
+    return decode<redirect_gram>(frame, msg);
+}
+
+bool decode_subtree(boost::string_view frame, subtree& msg)
+{
+    return decode<subtree_gram>(frame, msg);
+}
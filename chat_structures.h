@@ -2,7 +2,9 @@
 #ifndef CHAT_STRUCTURES_H
 #define CHAT_STRUCTURES_H
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #include <boost/optional.hpp>
 
@@ -30,19 +32,143 @@ struct connect_res
     host_info_opt host;
 };
 
+// Lookup of many rooms at once; unknown rooms get created with the
+// requester as host, like a single connect_req.
+struct connect_batch_req
+{
+    std::string from;
+    std::vector<std::string> rooms;
+    host_info host;
+};
+
+struct room_host
+{
+    std::string room;
+    std::string host_id;
+    host_info_opt host;     // empty if the requester now hosts the room
+};
+
+struct connect_batch_res
+{
+    int status;
+    std::vector<room_host> rooms;
+};
+
+// Sent periodically by a room host to keep its directory lease alive.
+struct heartbeat
+{
+    std::string from;
+    std::string room;
+    host_info host;
+};
+
+// `seq` numbers the messages of a room, the host gives it. 0 until then.
+// `sent` is when the sender wrote it, in microseconds of the wall clock,
+// for latency statistics.
 struct message
 {
     std::string from;
     std::string body;
+    std::uint32_t seq{0};
+    boost::optional<std::uint64_t> sent;
+};
+
+// Text messages carry seq zero-padded to this width, so the host numbers
+// an encoded frame in place.
+const int message_seq_digits = 10;
+
+// First frame a participant sends to the room host. `host` is where it
+// accepts the room if it ever takes over; the host replays the history
+// after message `after` to it, all of it for 0. A peer that reconnects
+// asks for what it missed this way.
+struct join
+{
+    std::string from;
+    host_info host;
+    std::uint32_t after;
+};
+
+struct successor
+{
+    std::string id;
+    host_info host;
+};
+
+// Participants that take the room over, in this order, when its host goes
+// away. Sent by the host to every participant and to the directory.
+struct standby
+{
+    std::string from;
+    std::string room;
+    std::vector<successor> successors;
+};
+
+// Relay mode: sent instead of accepting a join, the joiner goes to `to`.
+struct redirect
+{
+    std::string from;
+    successor to;
+};
+
+// Relay mode: peers in the subtree under `from`, itself included. Sent
+// upstream whenever it changes.
+struct subtree
+{
+    std::string from;
+    std::uint32_t size;
+};
+
+// Non-owning forms of the PDUs read on hot paths. Their fields point into
+// the frame they were decoded from and are only valid as long as it is.
+struct host_info_view
+{
+    boost::string_view address;
+    unsigned short port;
+};
+
+struct connect_req_view
+{
+    boost::string_view from;
+    boost::string_view room;
+    host_info_view host;
+};
+
+// `sent` is 0 when the message has none
+struct message_view
+{
+    boost::string_view from;
+    boost::string_view body;
+    std::uint32_t seq{0};
+    std::uint64_t sent{0};
 };
 
 //bool encode_message(const std::string& from, buffer_t& buf))
 bool encode_connection_req(connect_req const& msg, buffer_t& buf);
+bool encode_connection_req(connect_req const& msg, std::string& buf);
 bool encode_connection_res(connect_res const& msg, buffer_t& buf);
+bool encode_connection_res(connect_res const& msg, std::string& buf);
+bool encode_connect_batch_req(connect_batch_req const& msg, std::string& buf);
+bool encode_connect_batch_res(connect_batch_res const& msg, std::string& buf);
 bool encode_message(message const& msg, buffer_t& buf);
+bool encode_heartbeat(heartbeat const& msg, buffer_t& buf);
+bool encode_join(join const& msg, std::string& buf);
+bool encode_standby(standby const& msg, std::string& buf);
+bool encode_redirect(redirect const& msg, std::string& buf);
+bool encode_subtree(subtree const& msg, std::string& buf);
+
+bool decode_connect_req(boost::string_view frame, connect_req& msg);
+bool decode_connect_res(boost::string_view frame, connect_res& msg);
+bool decode_connect_batch_req(boost::string_view frame, connect_batch_req& msg);
+bool decode_connect_batch_res(boost::string_view frame, connect_batch_res& msg);
+bool decode_message(boost::string_view frame, message& msg);
+bool decode_heartbeat(boost::string_view frame, heartbeat& msg);
+bool decode_join(boost::string_view frame, join& msg);
+bool decode_standby(boost::string_view frame, standby& msg);
+bool decode_redirect(boost::string_view frame, redirect& msg);
+bool decode_subtree(boost::string_view frame, subtree& msg);
 
-bool decode_connect_req(buffer_t const& buf, connect_req& msg);
-bool decode_connect_res(buffer_t const& buf, connect_res& msg);
-bool decode_message(buffer_t const& buf, message& msg);
+// Hand-written decoders for the same text format, they never allocate.
+bool decode_connect_req(boost::string_view frame, connect_req_view& msg);
+bool decode_message(boost::string_view frame, message_view& msg);
 
 #endif  
\ No newline at end of file
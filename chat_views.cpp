@@ -0,0 +1,157 @@
+
+// Allocation free decoding of the text PDUs. Accepts exactly what the Qi
+// grammars in chat_structures.cpp accept, including the optional white
+// space between the tokens of the outer PDU.
+
+#include "chat_structures.h"
+
+namespace
+{
+
+class scanner
+{
+public:
+    explicit scanner(boost::string_view frame) :
+        p_(frame.data()),
+        e_(frame.data() + frame.size())
+    {}
+    
+    scanner& skip()
+    {
+        while (p_ != e_ && (*p_ == ' ' || (*p_ >= '\t' && *p_ <= '\r'))) ++p_;
+        return *this;
+    }
+    
+    bool lit(char c)
+    {
+        if (p_ == e_ || *p_ != c) return false;
+        ++p_;
+        return true;
+    }
+    
+    template <std::size_t N>
+    bool lit(const char (&s)[N])
+    {
+        if (std::size_t(e_ - p_) < N - 1 || std::memcmp(p_, s, N - 1) != 0) return false;
+        p_ += N - 1;
+        return true;
+    }
+    
+    // [0-9a-zA-Z@.]{min,max}, greedy like qi::repeat
+    bool id(boost::string_view& v, std::size_t min, std::size_t max)
+    {
+        auto b = p_;
+        while (p_ != e_ && std::size_t(p_ - b) < max && is_id(*p_)) ++p_;
+        
+        v = boost::string_view(b, p_ - b);
+        return v.size() >= min;
+    }
+    
+    // qi::short_ / qi::ushort_ within [min, max]
+    bool number(int& v, int min, int max)
+    {
+        bool negative = min < 0 && p_ != e_ && *p_ == '-';
+        if (min < 0 && p_ != e_ && (*p_ == '-' || *p_ == '+')) ++p_;
+        
+        auto b = p_;
+        long n = 0;
+        while (p_ != e_ && *p_ >= '0' && *p_ <= '9' && n <= max)
+        {
+            n = n * 10 + (*p_++ - '0');
+        }
+        
+        if (p_ == b) return false;
+        
+        v = negative ? -n : n;
+        return v >= min && v <= max;
+    }
+    
+    // qi::uint_parser<T>, which fails on overflow
+    template <typename T>
+    bool number(T& v)
+    {
+        auto b = p_;
+        T n = 0;
+        while (p_ != e_ && *p_ >= '0' && *p_ <= '9')
+        {
+            T d = *p_++ - '0';
+            if (n > (T(~T(0)) - d) / 10) return false;
+            n = n * 10 + d;
+        }
+        
+        v = n;
+        return p_ != b;
+    }
+    
+    bool peek(char c)
+    {
+        skip();
+        return p_ != e_ && *p_ == c;
+    }
+    
+    bool take(boost::string_view& v, std::size_t n)
+    {
+        if (std::size_t(e_ - p_) < n) return false;
+        v = boost::string_view(p_, n);
+        p_ += n;
+        return true;
+    }
+
+private:
+    static bool is_id(char c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+            || c == '@' || c == '.';
+    }
+    
+    const char* p_;
+    const char* e_;
+};
+
+bool quoted_id(scanner& s, boost::string_view& v)
+{
+    return s.skip().lit('"') && s.skip().id(v, 1, 16) && s.skip().lit('"');
+}
+
+// {"address":"...","port":N}, no white space allowed inside
+bool host(scanner& s, host_info_view& h)
+{
+    int port;
+    
+    if (!(s.lit('{') && s.lit("\"address\"") && s.lit(':') && s.lit('"') 
+        && s.id(h.address, 4, 64) && s.lit('"') && s.lit(',')
+        && s.lit("\"port\"") && s.lit(':') && s.number(port, 0, 65535) && s.lit('}')))
+    {
+        return false;
+    }
+    
+    h.port = static_cast<unsigned short>(port);
+    return true;
+}
+
+}
+
+bool decode_connect_req(boost::string_view frame, connect_req_view& msg)
+{
+    scanner s(frame);
+    
+    return s.skip().lit("connect-req") && s.skip().lit(':') && s.skip().lit('{')
+        && s.skip().lit("\"from\"") && s.skip().lit(':') && quoted_id(s, msg.from) && s.skip().lit(',')
+        && s.skip().lit("\"room\"") && s.skip().lit(':') && quoted_id(s, msg.room) && s.skip().lit(',')
+        && s.skip().lit("\"host\"") && s.skip().lit(':') && host(s.skip(), msg.host)
+        && s.skip().lit('}');
+}
+
+bool decode_message(boost::string_view frame, message_view& msg)
+{
+    scanner s(frame);
+    int len;
+    
+    return s.skip().lit("message") && s.skip().lit(':') && s.skip().lit('{')
+        && s.skip().lit("from") && s.skip().lit(':') && quoted_id(s, msg.from) && s.skip().lit(',')
+        && s.skip().lit("body:{len:") && s.number(len, -32768, 32767) && len >= 0 && s.lit(",msg:\"")
+        && s.take(msg.body, len) && s.lit("\"}")
+        && s.skip().lit(',') && s.skip().lit("seq") && s.skip().lit(':') && s.skip().number(msg.seq)
+        && (!s.peek(',') || (s.lit(',') && s.skip().lit("sent") && s.skip().lit(':') && s.skip().number(msg.sent)))
+        && s.skip().lit('}');
+}
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "chat_client.h"
+#include "chat_log.h"
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        
+        // options go first, the positional arguments are shifted past them
+        for (; argc > 2 && argv[1][0] == '-'; argc -= 2, argv += 2)
+        {
+            if (std::strcmp(argv[1], "-t") == 0)
+            {
+                threads = std::max(1, std::atoi(argv[2]));
+            }
+            else if (std::strcmp(argv[1], "-m") == 0)
+            {
+                max_message_size = std::strtoul(argv[2], nullptr, 10);
+            }
+            else if (std::strcmp(argv[1], "-w") == 0)
+            {
+                max_write_batch = std::strtoul(argv[2], nullptr, 10);
+            }
+            else if (std::strcmp(argv[1], "-q") == 0)
+            {
+                send_limits.messages = std::max(1ul, std::strtoul(argv[2], nullptr, 10));
+            }
+            else if (std::strcmp(argv[1], "-b") == 0)
+            {
+                send_limits.bytes = std::strtoul(argv[2], nullptr, 10);
+            }
+            else if (std::strcmp(argv[1], "-p") == 0)
+            {
+                std::string policy(argv[2]);
+                send_limits.policy = policy == "drop-newest" ? overflow_policy::drop_newest
+                    : policy == "disconnect" ? overflow_policy::disconnect
+                    : overflow_policy::drop_oldest;
+            }
+            else if (std::strcmp(argv[1], "-r") == 0)
+            {
+                history_depth = std::strtoul(argv[2], nullptr, 10);
+            }
+            else if (std::strcmp(argv[1], "-g") == 0)
+            {
+                send_limits.grace = std::chrono::milliseconds(std::atol(argv[2]));
+            }
+            else if (std::strcmp(argv[1], "-k") == 0)
+            {
+                standby_count = std::strtoul(argv[2], nullptr, 10);
+            }
+            else if (std::strcmp(argv[1], "-f") == 0)
+            {
+                relay_fanout = std::strtoul(argv[2], nullptr, 10);
+            }
+            else if (std::strcmp(argv[1], "-v") == 0)
+            {
+                log_level level;
+                if (!parse_log_level(argv[2], level))
+                {
+                    argc = 0;
+                    break;
+                }
+                
+                set_log_level(level);
+            }
+            else
+            {
+                break;
+            }
+        }
+        
+        if (argc != 6 && argc != 7)
+        {
+            std::cerr << "Usage: chat_client [-t threads] [-m max_message_size] [-w max_write_batch]"
+                " [-q queue_messages] [-b queue_bytes] [-p drop-oldest|drop-newest|disconnect] [-g grace_ms]"
+                " [-r history_depth] [-k standby_hosts] [-f relay_fanout] [-v debug|info|warning|error|none]"
+                " <host> <port> <room> <name> <listen_port> [text|binary]\n";
+            return 1;
+        }
+        
+        auto format = argc == 7 && std::string(argv[6]) == "binary" 
+            ? wire_format::binary : wire_format::text;
+        
+        boost::asio::io_service io_service;
+        
+        tcp::resolver resolver(io_service);
+        auto remote = resolver.resolve({ argv[1], argv[2] });
+        
+        std::string room(argv[3]);
+        std::string id(argv[4]);
+        chat_client c(io_service, remote, room, id, std::atoi(argv[5]), format);
+        
+        std::vector<std::thread> pool;
+        for (unsigned i = 0; i < threads; ++i)
+        {
+            pool.emplace_back([&io_service](){ io_service.run(); });
+        }
+        
+        // lines typed before the peer is in its room wait in its queue
+        message input { id, std::string(), 0, boost::none };
+        while (std::getline(std::cin, input.body))
+        {
+            if (input.body.empty()) continue;
+            
+            if (input.body == "/stats")
+            {
+                std::cout << "system> dropped " << send_stats.dropped 
+                    << " messages, evicted " << send_stats.evicted << " participants" << std::endl;
+                
+                std::cout << "system> latency to host: ";
+                c.room().to_host().print(std::cout);
+                std::cout << std::endl << "system> latency to here: ";
+                c.room().to_peer().print(std::cout);
+                std::cout << std::endl;
+                continue;
+            }
+            
+            std::cout << "\e[A" << "You> " << input.body << std::endl;
+            
+            auto msg = make_frame();
+            input.sent = wall_clock_us();
+            
+            if (encode_chat_message(input, *msg))
+            {
+                c.write(msg);
+            }
+        }
+        
+        c.close();
+        for (auto& t: pool)
+        {
+            t.join();
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+    
+    return 0;
+}
@@ -0,0 +1,278 @@
+
+#include "chat_client.h"
+
+// The socket's executor is the session's strand, every handler of the
+// session runs on it.
+void chat_session::start()
+{
+    boost::asio::dispatch(socket_.get_executor(), [this, self = shared_from_this()]() { do_read(); });
+}
+
+// Broadcasts come on the session's strand already.
+void chat_session::deliver(const chat_message& msg)
+{
+    if (strand_.running_in_this_thread())
+    {
+        enqueue(msg);
+        return;
+    }
+    
+    boost::asio::dispatch(strand_,
+        [this, self = shared_from_this(), msg]() { enqueue(msg); });
+}
+
+void chat_session::close()
+{
+    boost::asio::dispatch(socket_.get_executor(),
+        [this, self = shared_from_this()]()
+        {
+            leave();
+            grace_timer_.cancel();
+            socket_.close();
+        });
+}
+
+void chat_session::enqueue(const chat_message& msg)
+{
+    auto size = frame_size(*msg);
+    if (!make_room(size))
+    {
+        ++send_stats.dropped;
+        return;
+    }
+    
+    bool write_in_progress = !write_msgs_.empty();
+    write_msgs_.push_back(msg);
+    queued_bytes_ += size;
+    if (!write_in_progress)
+    {
+        do_write();
+    }
+}
+
+void chat_session::leave()
+{
+    if (slot_ != no_participant)
+    {
+        room_.leave(slot_);
+        slot_ = no_participant;
+    }
+}
+
+bool chat_session::fits(std::size_t size) const
+{
+    return write_msgs_.size() < send_limits.messages
+        && queued_bytes_ + size <= send_limits.bytes;
+}
+
+// Applies the overflow policy, true if the message can be queued.
+bool chat_session::make_room(std::size_t size)
+{
+    if (fits(size))
+    {
+        return true;
+    }
+    
+    switch (send_limits.policy)
+    {
+    case overflow_policy::drop_oldest:
+        // messages handed to the current write cannot be taken back
+        while (!fits(size) && write_msgs_.size() > writing_)
+        {
+            queued_bytes_ -= frame_size(*write_msgs_[writing_]);
+            write_msgs_.erase(writing_);
+            ++send_stats.dropped;
+        }
+        return fits(size);
+    
+    case overflow_policy::drop_newest:
+        return false;
+    
+    case overflow_policy::disconnect:
+        if (!over_limit_)
+        {
+            over_limit_ = true;
+            start_grace();
+        }
+        return false;
+    }
+    
+    return false;
+}
+
+void chat_session::start_grace()
+{
+    grace_timer_.expires_from_now(send_limits.grace);
+    grace_timer_.async_wait(
+        [this, self = shared_from_this()](boost::system::error_code ec)
+        {
+            if (ec || !over_limit_) return;
+            
+            ++send_stats.evicted;
+            leave();
+            socket_.close();
+        });
+}
+
+void chat_session::do_read()
+{
+    socket_.async_read_some(boost::asio::buffer(in_.tail(), in_.tail_size()), make_alloc_handler(read_memory_,
+        [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length)
+        {
+            if (ec)
+            {
+                leave();
+                socket_.close();
+                return;
+            }
+            
+            in_.commit(length);
+            
+            // one read may carry several messages and the start of the next
+            boost::string_view frame;
+            while (in_.next(frame))
+            {
+                message_view msg;
+                join request;
+                subtree load;
+                
+                if (decode_any(frame, msg))
+                {
+                    // a peer that never sent a join still gets the room
+                    if (slot_ == no_participant) slot_ = room_.join(self, strand_);
+                    if (id.empty()) id = msg.from.to_string();
+                    
+                    auto out = make_frame();
+                    store_frame(frame, *out);
+                    room_.deliver(out, slot_, msg.seq, msg.sent);
+                    
+                    // a relay shows its subtree's once the host sent them back
+                    if (room_.hosted()) output_.message(msg.from, msg.body);
+                }
+                else if (slot_ == no_participant && decode_any(frame, request))
+                {
+                    id = request.from;
+                    
+                    successor relay;
+                    if (room_.place(relay))
+                    {
+                        // the joiner closes the connection once it has this
+                        auto format = is_binary(frame) ? wire_format::binary : wire_format::text;
+                        auto out = std::make_shared<chat_frame>();
+                        if (encode_control(redirect{owner_, relay}, format, *out))
+                        {
+                            enqueue(out);
+                        }
+                        continue;
+                    }
+                    
+                    slot_ = room_.join(self, strand_, request.after);
+                    room_.enlist(slot_, successor{request.from, request.host});
+                }
+                else if (slot_ != no_participant && decode_any(frame, load))
+                {
+                    room_.set_load(slot_, load.size);
+                }
+            }
+            output_.flush();
+            
+            auto large = oversized_frame(in_);
+            
+            if (large > max_message_size || (!large && in_.full()))
+            {
+                leave();
+                socket_.close();
+                return;
+            }
+            
+            if (large)
+            {
+                do_read_large(large);
+            }
+            else
+            {
+                do_read();
+            }
+        }));
+}
+
+// A frame bigger than the stream buffer is read straight into segments.
+void chat_session::do_read_large(std::size_t size)
+{
+    auto rest = in_.pending();
+    large_.clear();
+    large_.append(rest);
+    auto buffers = large_.prepare(size - rest.size());
+    in_.reset();
+    
+    boost::asio::async_read(socket_, buffers, make_alloc_handler(read_memory_,
+        [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length)
+        {
+            if (ec)
+            {
+                leave();
+                socket_.close();
+                return;
+            }
+            
+            large_.commit(length);
+            
+            boost::string_view from;
+            std::uint32_t body_size;
+            std::size_t head_size;
+            std::uint32_t seq;
+            std::uint64_t sent;
+            
+            if (decode_message_head(large_.front(), from, body_size, head_size, seq, sent))
+            {
+                if (slot_ == no_participant) slot_ = room_.join(self, strand_);
+                if (id.empty()) id = from.to_string();
+                
+                // the segments move, so `from` stays valid
+                auto out = make_frame();
+                out->large = std::move(large_);
+                room_.deliver(out, slot_, seq, sent);
+                
+                if (room_.hosted()) output_.message(from, out->large, head_size);
+            }
+            
+            do_read();
+        }));
+}
+
+// everything queued so far goes out in one gather write
+void chat_session::do_write()
+{
+    writing_ = async_write_queue(socket_, write_msgs_, gather_, make_alloc_handler(write_memory_,
+        [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length)
+        {
+            if (!ec)
+            {
+                write_msgs_.pop_front(writing_);
+                queued_bytes_ -= length;
+                writing_ = 0;
+                
+                // caught up within the grace period
+                if (over_limit_ && fits(0))
+                {
+                    over_limit_ = false;
+                    grace_timer_.cancel();
+                }
+                
+                if (!write_msgs_.empty())
+                {
+                    do_write();
+                }
+            }
+            else
+            {
+                // nothing queued will go out, the reads fail too now
+                write_msgs_.clear();
+                queued_bytes_ = 0;
+                writing_ = 0;
+                leave();
+                grace_timer_.cancel();
+                socket_.close();
+            }
+        }));
+}
@@ -0,0 +1,281 @@
+// Room failover time. Starts a directory and <peers> peers in one room on
+// loopback, then closes the host <rounds> times in a row and measures how
+// long its standby takes to host the room, how long the others take to
+// connect to it again, and when every one of them got a message from the
+// new host. Times are from the moment the old host was closed.
+// Usage: chat-failover-bench [<peers> [<rounds> [<standbys>]]]
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chat_client.h"
+#include "chat_server.h"
+
+namespace
+{
+
+typedef std::chrono::steady_clock clock_type;
+
+const auto round_timeout = std::chrono::seconds(10);
+
+// the new host repeats its message until everyone has it, since a
+// participant that connected is not necessarily accepted yet
+const auto resend_interval = std::chrono::milliseconds(1);
+
+// Collects the events of every peer of the current round.
+class monitor
+{
+public:
+    void reset(clock_type::time_point start)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start_ = start;
+        host_ = -1;
+        joined_.clear();
+        delivered_.clear();
+        reached_.clear();
+        marker_.clear();
+    }
+    
+    void expect(const std::string& marker)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        marker_ = marker;
+    }
+    
+    void hosting(int peer)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        host_ = peer;
+        took_over_ = elapsed();
+        changed_.notify_all();
+    }
+    
+    void connected()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        joined_.push_back(elapsed());
+        changed_.notify_all();
+    }
+    
+    void message(int peer, boost::string_view body)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!marker_.empty() && body == marker_ && reached_.insert(peer).second)
+        {
+            delivered_.push_back(elapsed());
+            changed_.notify_all();
+        }
+    }
+    
+    // false on timeout
+    bool wait_host(int& peer, double& took_over)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!changed_.wait_for(lock, round_timeout, [this]() { return host_ >= 0; }))
+        {
+            return false;
+        }
+        
+        peer = host_;
+        took_over = took_over_;
+        return true;
+    }
+    
+    bool wait_joined(std::size_t count, std::vector<double>& times)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!changed_.wait_for(lock, round_timeout, [this, count]() { return joined_.size() >= count; }))
+        {
+            return false;
+        }
+        
+        times = joined_;
+        return true;
+    }
+    
+    bool wait_delivered(std::size_t count, std::vector<double>& times, clock_type::duration timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!changed_.wait_for(lock, timeout, [this, count]() { return delivered_.size() >= count; }))
+        {
+            return false;
+        }
+        
+        times = delivered_;
+        return true;
+    }
+
+private:
+    // milliseconds since the round started, under the lock
+    double elapsed() const
+    {
+        return std::chrono::duration<double, std::milli>(clock_type::now() - start_).count();
+    }
+    
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    clock_type::time_point start_{clock_type::now()};
+    int host_{-1};
+    double took_over_{0};
+    std::vector<double> joined_;
+    std::vector<double> delivered_;
+    std::set<int> reached_;
+    std::string marker_;
+};
+
+class peer_output : public chat_output
+{
+public:
+    peer_output(monitor& m, int peer) : monitor_(m), peer_(peer) {}
+    
+    void message(boost::string_view, boost::string_view body) override
+    {
+        monitor_.message(peer_, body);
+    }
+    
+    void message(boost::string_view, const segment_chain&, std::size_t) override {}
+    
+    void event(peer_event e, const std::string&) override
+    {
+        if (e == peer_event::hosting)
+        {
+            monitor_.hosting(peer_);
+        }
+        else if (e == peer_event::connected)
+        {
+            monitor_.connected();
+        }
+    }
+
+private:
+    monitor& monitor_;
+    int peer_;
+};
+
+double percentile(std::vector<double> times, double p)
+{
+    std::sort(times.begin(), times.end());
+    return times[std::min(times.size() - 1, std::size_t(p * times.size()))];
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int peers  = argc > 1 ? std::atoi(argv[1]) : 8;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 5;
+    standby_count = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 2;
+    
+    // every round loses a peer, the last one needs a participant left
+    if (peers < rounds + 2 || standby_count < 1)
+    {
+        std::cerr << "Usage: chat-failover-bench [<peers> [<rounds> [<standbys>]]]"
+            ", with peers > rounds + 1 and standbys > 0\n";
+        return 1;
+    }
+    
+    room_registry directory;
+    server_metrics metrics;
+    boost::asio::io_service io;
+    chat_server server(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), directory, metrics);
+    
+    tcp::resolver resolver(io);
+    auto remote = resolver.resolve({"127.0.0.1", std::to_string(server.local_endpoint().port())});
+    
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i)
+    {
+        pool.emplace_back([&io](){ io.run(); });
+    }
+    
+    monitor events;
+    std::vector<std::unique_ptr<peer_output>> outputs;
+    std::vector<std::unique_ptr<chat_client>> clients;
+    
+    auto add_peer = [&](int i)
+    {
+        outputs.emplace_back(new peer_output(events, i));
+        clients.emplace_back(new chat_client(io, remote, "bench", "peer" + std::to_string(i), 0,
+            wire_format::binary, *outputs.back()));
+    };
+    
+    // the first peer creates the room, the others join it in order
+    int host = -1;
+    double took_over = 0;
+    bool ok = true;
+    
+    events.reset(clock_type::now());
+    add_peer(0);
+    ok = events.wait_host(host, took_over);
+    
+    std::vector<double> joined;
+    for (int i = 1; i < peers; ++i) add_peer(i);
+    ok = ok && events.wait_joined(peers - 1, joined);
+    
+    // let the successor list reach everyone
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    
+    // the server logs every accept to stdout, so results go to stderr
+    std::cerr << "round,participants,takeover_ms,rejoin_p50_ms,rejoin_max_ms,delivered_max_ms\n";
+    
+    for (int round = 1; ok && round <= rounds; ++round)
+    {
+        std::size_t participants = peers - round - 1;
+        
+        events.reset(clock_type::now());
+        clients[host]->close();
+        
+        std::vector<double> delivered;
+        ok = events.wait_host(host, took_over) && events.wait_joined(participants, joined);
+        
+        if (ok)
+        {
+            auto marker = "round " + std::to_string(round);
+            events.expect(marker);
+            
+            message text{clients[host]->id(), marker, 0, boost::none};
+            
+            // a frame each time, the host keeps the one it numbered
+            auto deadline = clock_type::now() + round_timeout;
+            do
+            {
+                auto msg = make_frame();
+                encode_chat_message(text, *msg);
+                clients[host]->write(msg);
+                ok = events.wait_delivered(participants, delivered, resend_interval);
+            }
+            while (!ok && clock_type::now() < deadline);
+        }
+        
+        if (!ok)
+        {
+            std::cerr << round << ",failed\n";
+            break;
+        }
+        
+        std::cerr << round << ',' << participants << std::fixed << std::setprecision(3)
+            << ',' << took_over
+            << ',' << percentile(joined, 0.5)
+            << ',' << percentile(joined, 1.0)
+            << ',' << percentile(delivered, 1.0) << std::endl;
+        
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    
+    for (auto& c: clients) c->close();
+    io.stop();
+    for (auto& t: pool) t.join();
+    
+    return ok ? 0 : 1;
+}
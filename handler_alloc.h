@@ -0,0 +1,121 @@
+#ifndef HANDLER_ALLOC_H
+#define HANDLER_ALLOC_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Memory for the state asio keeps of one outstanding operation, owned by
+// the object that starts it. asio frees an operation before it calls the
+// handler, so the next operation started from the handler gets the same
+// block again; a session does its reads and writes without touching the
+// heap, whichever thread of the pool completes them. Requests larger than
+// the block, or made while it is taken, fall back to the heap.
+//
+// Not synchronized: the operations sharing a block must follow each
+// other, as the reads of one socket do.
+class handler_memory
+{
+public:
+    handler_memory() = default;
+    
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+    
+    void* allocate(std::size_t size)
+    {
+        if (!in_use_ && size <= sizeof(storage_))
+        {
+            in_use_ = true;
+            return &storage_;
+        }
+        
+        return ::operator new(size);
+    }
+    
+    void deallocate(void* p)
+    {
+        if (p == &storage_)
+        {
+            in_use_ = false;
+        }
+        else
+        {
+            ::operator delete(p);
+        }
+    }
+
+private:
+    // a socket read or a gather write with its strand wrapping fits
+    typename std::aligned_storage<1024>::type storage_;
+    bool in_use_{false};
+};
+
+// The allocator asio finds through a handler's get_allocator().
+template <typename T>
+class handler_allocator
+{
+public:
+    typedef T value_type;
+    
+    explicit handler_allocator(handler_memory& memory) : memory_(memory) {}
+    
+    template <typename U>
+    handler_allocator(const handler_allocator<U>& other) noexcept : memory_(other.memory_) {}
+    
+    bool operator==(const handler_allocator& other) const noexcept { return &memory_ == &other.memory_; }
+    bool operator!=(const handler_allocator& other) const noexcept { return &memory_ != &other.memory_; }
+    
+    T* allocate(std::size_t n) const
+    {
+        return static_cast<T*>(memory_.allocate(sizeof(T) * n));
+    }
+    
+    void deallocate(T* p, std::size_t) const
+    {
+        memory_.deallocate(p);
+    }
+
+private:
+    template <typename> friend class handler_allocator;
+    
+    handler_memory& memory_;
+};
+
+template <typename Handler>
+class alloc_handler
+{
+public:
+    typedef handler_allocator<Handler> allocator_type;
+    
+    alloc_handler(handler_memory& memory, Handler handler) :
+        memory_(memory),
+        handler_(std::move(handler))
+    {}
+    
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(memory_);
+    }
+    
+    template <typename... Args>
+    void operator()(Args&&... args)
+    {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    handler_memory& memory_;
+    Handler handler_;
+};
+
+// `handler` with its operation's state kept in `memory`.
+template <typename Handler>
+alloc_handler<typename std::decay<Handler>::type> make_alloc_handler(handler_memory& memory, Handler&& handler)
+{
+    return alloc_handler<typename std::decay<Handler>::type>(memory, std::forward<Handler>(handler));
+}
+
+#endif
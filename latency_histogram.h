@@ -0,0 +1,133 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+// Log-linear histogram of durations, HDR style. Values below 2 * sub
+// have a bucket each; above, every power of two is split into `sub` equal
+// buckets, so a bucket is never wider than 1/sub of its values. Recording
+// is a relaxed increment and any thread records without a lock; readers
+// get a consistent enough view for percentiles while it keeps counting.
+//
+// Values are whole units of the caller's choosing, up to max_value: about
+// 71 minutes of microseconds, what the peers record and print() assumes,
+// or 4.3 seconds of nanoseconds. Longer ones count as max_value.
+class latency_histogram
+{
+public:
+    static constexpr int sub_bits = 5;
+    static constexpr std::uint64_t sub = std::uint64_t(1) << sub_bits;
+    
+    // longer ones are counted here
+    static constexpr int max_bits = 32;
+    static constexpr std::uint64_t max_value = (std::uint64_t(1) << max_bits) - 1;
+    static constexpr std::size_t buckets = (max_bits - sub_bits + 1) * sub;
+    
+    latency_histogram()
+    {
+        for (auto& c: counts_) c = 0;
+    }
+    
+    latency_histogram(const latency_histogram&) = delete;
+    latency_histogram& operator=(const latency_histogram&) = delete;
+    
+    void record(std::uint64_t us)
+    {
+        if (us > max_value) us = max_value;
+        
+        counts_[index(us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        
+        auto max = max_.load(std::memory_order_relaxed);
+        while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+    }
+    
+    // adds the counts of `other`, to report many peers as one
+    void merge(const latency_histogram& other)
+    {
+        for (std::size_t i = 0; i < buckets; ++i)
+        {
+            counts_[i].fetch_add(other.counts_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        
+        count_.fetch_add(other.count(), std::memory_order_relaxed);
+        
+        auto theirs = other.max();
+        auto max = max_.load(std::memory_order_relaxed);
+        while (theirs > max && !max_.compare_exchange_weak(max, theirs, std::memory_order_relaxed)) {}
+    }
+    
+    std::uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    
+    // Highest value of the bucket holding the `p` quantile, 0 if empty.
+    std::uint64_t percentile(double p) const
+    {
+        auto total = count();
+        if (total == 0)
+        {
+            return 0;
+        }
+        
+        auto rank = std::max<std::uint64_t>(1, std::uint64_t(p * total + 0.5));
+        std::uint64_t seen = 0;
+        
+        for (std::size_t i = 0; i < buckets; ++i)
+        {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                return std::min(highest(i), max());
+            }
+        }
+        
+        return max();
+    }
+    
+    // "<count> p50 <ms> p99 <ms> p999 <ms> max <ms> ms"
+    void print(std::ostream& os) const
+    {
+        auto ms = [](std::uint64_t us) { return us / 1000.0; };
+        
+        os << count() << std::fixed << std::setprecision(3)
+            << " p50 " << ms(percentile(0.5))
+            << " p99 " << ms(percentile(0.99))
+            << " p999 " << ms(percentile(0.999))
+            << " max " << ms(max()) << " ms";
+    }
+
+private:
+    static int msb(std::uint64_t v)
+    {
+        return 63 - __builtin_clzll(v);
+    }
+    
+    // e is how far the value is shifted to fit [sub, 2 * sub)
+    static std::size_t index(std::uint64_t v)
+    {
+        int e = v < 2 * sub ? 0 : msb(v) - sub_bits;
+        return e * sub + (v >> e);
+    }
+    
+    static std::uint64_t highest(std::size_t i)
+    {
+        if (i < 2 * sub)
+        {
+            return i;
+        }
+        
+        int e = i / sub - 1;
+        return ((i - e * sub + 1) << e) - 1;
+    }
+    
+    std::array<std::atomic<std::uint64_t>, buckets> counts_;
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+#endif
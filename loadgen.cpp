@@ -0,0 +1,401 @@
+// End to end load. Starts a directory and <rooms> rooms of <clients> peers
+// each in one process on loopback, the peers going through the directory
+// and the room hosts like chat-client does. Then every peer sends <rate>
+// messages a second of <size> bytes for <seconds>, and the run reports how
+// long peers took to connect and to join, the throughput, and the latency
+// to the hosts and to every peer from the rooms' histograms. Results go to
+// stderr, the directory logs every accept to stdout.
+// Usage: chat-loadgen [-t threads] [-r rooms] [-c clients] [-m rate] [-s size]
+//     [-d seconds] [-f relay_fanout] [text|binary]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "chat_client.h"
+#include "chat_server.h"
+
+namespace
+{
+
+typedef std::chrono::steady_clock clock_type;
+
+const auto join_timeout = std::chrono::seconds(60);
+const auto drain_timeout = std::chrono::seconds(5);
+
+// every run measures from here
+const auto epoch = clock_type::now();
+
+double since_epoch_ms(clock_type::time_point t = clock_type::now())
+{
+    return std::chrono::duration<double, std::milli>(t - epoch).count();
+}
+
+// what the hosts put in their history, everything else is load
+const char* const history_marker = "hello";
+
+struct totals
+{
+    std::atomic<std::size_t> connected{0};
+    std::atomic<std::size_t> joined{0};
+    std::atomic<std::uint64_t> sent{0};
+    std::atomic<std::uint64_t> delivered{0};
+    std::atomic<std::uint64_t> bytes{0};
+};
+
+// What one peer saw. Called from its own strand and from the strands of
+// the sessions it hosts, so behind a lock.
+class peer_output : public chat_output
+{
+public:
+    explicit peer_output(totals& t) : totals_(t) {}
+    
+    void start() { started_ = since_epoch_ms(); }
+    
+    void message(boost::string_view, boost::string_view body) override
+    {
+        received(body, body.size());
+    }
+    
+    void message(boost::string_view, const segment_chain& frame, std::size_t skip) override
+    {
+        received(frame.front().substr(skip), frame.size() - skip);
+    }
+    
+    void event(peer_event e, const std::string&) override
+    {
+        if (e != peer_event::connected && e != peer_event::hosting)
+        {
+            return;
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (connected_ < 0)
+        {
+            connected_ = since_epoch_ms() - started_;
+            ++totals_.connected;
+            
+            // the host is in the room as soon as it has it
+            if (e == peer_event::hosting) joined();
+        }
+    }
+    
+    // milliseconds after start(), -1 until it happened
+    double connected() { std::lock_guard<std::mutex> lock(mutex_); return connected_; }
+    double joined_at() { std::lock_guard<std::mutex> lock(mutex_); return joined_; }
+
+private:
+    void received(boost::string_view head, std::size_t size)
+    {
+        if (!head.starts_with(history_marker))
+        {
+            ++totals_.delivered;
+            totals_.bytes += size;
+            return;
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (joined_ < 0) joined();
+    }
+    
+    // under the lock
+    void joined()
+    {
+        joined_ = since_epoch_ms() - started_;
+        ++totals_.joined;
+    }
+    
+    totals& totals_;
+    std::mutex mutex_;
+    double started_{0};
+    double connected_{-1};
+    double joined_{-1};
+};
+
+// Sends `rate` messages a second from one peer until `stop`, on a timer so
+// a late tick does not shift the ones after it.
+class sender : public std::enable_shared_from_this<sender>
+{
+public:
+    sender(boost::asio::io_service& io, chat_client& client, totals& t, double rate, std::size_t size) :
+        timer_(io),
+        client_(client),
+        totals_(t),
+        period_(std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(1 / rate))),
+        size_(size)
+    {}
+    
+    // `offset` spreads the peers over a period
+    void start(clock_type::time_point stop, double offset)
+    {
+        stop_ = stop;
+        next_ = clock_type::now() + std::chrono::duration_cast<clock_type::duration>(period_ * offset);
+        wait();
+    }
+
+private:
+    void wait()
+    {
+        auto self(shared_from_this());
+        timer_.expires_at(next_);
+        timer_.async_wait(
+            [this, self](boost::system::error_code ec)
+            {
+                if (ec || clock_type::now() >= stop_) return;
+                
+                message m{client_.id(), std::string(size_, 'x'), 0, wall_clock_us()};
+                
+                auto msg = make_frame();
+                if (encode_chat_message(m, *msg))
+                {
+                    client_.write(msg);
+                    ++totals_.sent;
+                }
+                
+                next_ += period_;
+                wait();
+            });
+    }
+    
+    boost::asio::steady_timer timer_;
+    chat_client& client_;
+    totals& totals_;
+    clock_type::duration period_;
+    std::size_t size_;
+    clock_type::time_point stop_;
+    clock_type::time_point next_;
+};
+
+double percentile(std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, std::size_t(p * sorted.size()))];
+}
+
+void report(const char* name, std::vector<double> times)
+{
+    std::sort(times.begin(), times.end());
+    
+    std::cerr << name << std::fixed << std::setprecision(3)
+        << ": p50 " << percentile(times, 0.5)
+        << " p90 " << percentile(times, 0.9)
+        << " p99 " << percentile(times, 0.99)
+        << " p999 " << percentile(times, 0.999)
+        << " max " << percentile(times, 1.0) << " ms" << std::endl;
+}
+
+// Waits until `done` or the timeout, false on timeout.
+template <typename Done>
+bool wait_for(Done done, clock_type::duration timeout)
+{
+    auto deadline = clock_type::now() + timeout;
+    while (!done())
+    {
+        if (clock_type::now() >= deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    
+    return true;
+}
+
+// each peer takes a listening socket, its connection and the host's end
+void raise_file_limit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int rooms = 10;
+    int clients = 100;
+    double rate = 1;
+    std::size_t size = 100;
+    int seconds = 10;
+    
+    for (; argc > 2 && argv[1][0] == '-'; argc -= 2, argv += 2)
+    {
+        if (std::strcmp(argv[1], "-t") == 0)
+        {
+            threads = std::max(1, std::atoi(argv[2]));
+        }
+        else if (std::strcmp(argv[1], "-r") == 0)
+        {
+            rooms = std::atoi(argv[2]);
+        }
+        else if (std::strcmp(argv[1], "-c") == 0)
+        {
+            clients = std::atoi(argv[2]);
+        }
+        else if (std::strcmp(argv[1], "-m") == 0)
+        {
+            rate = std::atof(argv[2]);
+        }
+        else if (std::strcmp(argv[1], "-s") == 0)
+        {
+            size = std::strtoul(argv[2], nullptr, 10);
+        }
+        else if (std::strcmp(argv[1], "-d") == 0)
+        {
+            seconds = std::atoi(argv[2]);
+        }
+        else if (std::strcmp(argv[1], "-f") == 0)
+        {
+            relay_fanout = std::strtoul(argv[2], nullptr, 10);
+        }
+        else
+        {
+            break;
+        }
+    }
+    
+    if (argc > 2 || rooms < 1 || clients < 2 || rate <= 0 || seconds < 1)
+    {
+        std::cerr << "Usage: chat-loadgen [-t threads] [-r rooms] [-c clients] [-m rate] [-s size]"
+            " [-d seconds] [-f relay_fanout] [text|binary]\n";
+        return 1;
+    }
+    
+    auto format = argc == 2 && std::string(argv[1]) == "binary"
+        ? wire_format::binary : wire_format::text;
+    
+    raise_file_limit();
+    
+    room_registry directory;
+    server_metrics metrics;
+    boost::asio::io_service io;
+    chat_server server(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), directory, metrics);
+    
+    tcp::resolver resolver(io);
+    auto remote = resolver.resolve({"127.0.0.1", std::to_string(server.local_endpoint().port())});
+    
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        pool.emplace_back([&io](){ io.run(); });
+    }
+    
+    totals total;
+    std::vector<std::unique_ptr<peer_output>> outputs;
+    std::vector<std::unique_ptr<chat_client>> peers;
+    
+    auto add_peer = [&](int room, int i)
+    {
+        outputs.emplace_back(new peer_output(total));
+        outputs.back()->start();
+        peers.emplace_back(new chat_client(io, remote, "room" + std::to_string(room),
+            "r" + std::to_string(room) + "p" + std::to_string(i), 0, format, *outputs.back()));
+    };
+    
+    // the hosts first, each with a message in its history; a peer has
+    // joined once that reached it
+    for (int r = 0; r < rooms; ++r) add_peer(r, 0);
+    bool ok = wait_for([&]() { return total.joined == std::size_t(rooms); }, join_timeout);
+    
+    for (int r = 0; ok && r < rooms; ++r)
+    {
+        auto hello = make_frame();
+        encode_chat_message(message{peers[r]->id(), history_marker, 0, boost::none}, *hello);
+        peers[r]->write(hello);
+    }
+    
+    auto joining = clock_type::now();
+    for (int i = 1; ok && i < clients; ++i)
+    {
+        for (int r = 0; r < rooms; ++r) add_peer(r, i);
+    }
+    
+    ok = ok && wait_for([&]() { return total.joined == peers.size(); }, join_timeout);
+    auto join_time = std::chrono::duration<double>(clock_type::now() - joining).count();
+    
+    if (!ok)
+    {
+        std::cerr << "failed: " << total.connected << " of " << rooms * clients << " peers connected, "
+            << total.joined << " joined\n";
+    }
+    
+    // the load
+    std::uint64_t expected = 0;
+    double elapsed = 0;
+    
+    if (ok)
+    {
+        auto start = clock_type::now();
+        auto stop = start + std::chrono::seconds(seconds);
+        
+        for (std::size_t i = 0; i < peers.size(); ++i)
+        {
+            auto s = std::make_shared<sender>(io, *peers[i], total, rate, size);
+            s->start(stop, double(i) / peers.size());
+        }
+        
+        std::this_thread::sleep_for(stop - clock_type::now());
+        
+        // everyone in a room gets what the others send
+        expected = total.sent * (clients - 1);
+        wait_for([&]() { return total.delivered >= expected; }, drain_timeout);
+        elapsed = std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+    
+    std::vector<double> connect_times, join_times;
+    for (auto& out: outputs)
+    {
+        if (out->connected() >= 0) connect_times.push_back(out->connected());
+        if (out->joined_at() >= 0) join_times.push_back(out->joined_at());
+    }
+    
+    // only the hosts count arrivals
+    latency_histogram to_host, to_peer;
+    for (auto& p: peers)
+    {
+        to_host.merge(p->room().to_host());
+        to_peer.merge(p->room().to_peer());
+    }
+    
+    std::cerr << "rooms " << rooms << ", peers " << peers.size() << ", threads " << threads
+        << ", " << rate << " msg/s of " << size << " bytes per peer for " << seconds << " s"
+        << (format == wire_format::binary ? ", binary" : ", text")
+        << (relay_fanout ? ", fanout " + std::to_string(relay_fanout) : std::string()) << std::endl;
+    
+    std::cerr << std::fixed << std::setprecision(3)
+        << "joined in " << join_time << " s" << std::endl;
+    report("connect", connect_times);
+    report("join", join_times);
+    
+    if (ok)
+    {
+        std::cerr << std::fixed << std::setprecision(1)
+            << "sent " << total.sent << ", delivered " << total.delivered << " of " << expected
+            << ", " << total.delivered / elapsed << " msg/s, "
+            << total.bytes / elapsed / (1 << 20) << " MiB/s" << std::endl;
+        std::cerr << "to host: ";
+        to_host.print(std::cerr);
+        std::cerr << std::endl << "to peers: ";
+        to_peer.print(std::cerr);
+        std::cerr << std::endl;
+    }
+    
+    for (auto& p: peers) p->close();
+    io.stop();
+    for (auto& t: pool) t.join();
+    
+    return ok && total.delivered >= expected ? 0 : 1;
+}
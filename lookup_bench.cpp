@@ -0,0 +1,168 @@
+
+// Directory lookup throughput for an increasing number of io_service threads.
+// Every client keeps one connection and pipelines <depth> requests at a time.
+// Heap allocations made on the server's threads once every client is
+// connected are counted too, steady state lookups should make none.
+// Usage: chat-lookup-bench [<rooms> [<clients> [<seconds> [<max_threads> [<depth>]]]]]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "alloc_count.h"
+#include "chat_server.h"
+
+namespace
+{
+
+struct result
+{
+    double lookups;     // per second
+    double allocations; // per lookup
+};
+
+template <typename Rooms>
+bool lookup(tcp::socket& socket, const std::string& from, Rooms next_room, int depth)
+{
+    std::string batch;
+    for (int i = 0; i < depth; ++i)
+    {
+        connect_req req{from, next_room(), {"127.0.0.1", 0}};
+        if (!encode_connection_req(req, batch))
+        {
+            return false;
+        }
+        
+        batch.push_back('\n');
+    }
+    
+    boost::system::error_code ec;
+    boost::asio::write(socket, boost::asio::buffer(batch), ec);
+    
+    boost::asio::streambuf res;
+    for (int i = 0; i < depth && !ec; ++i)
+    {
+        res.consume(boost::asio::read_until(socket, res, '\n', ec));
+    }
+    
+    return !ec;
+}
+
+result run(unsigned threads, int rooms, int clients, int seconds, int depth)
+{
+    room_registry directory;
+    server_metrics metrics;
+    boost::asio::io_service io;
+    chat_server server(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), directory, metrics);
+    auto endpoint = server.local_endpoint();
+    
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        pool.emplace_back([&io](){ count_allocations = true; io.run(); });
+    }
+    
+    // hosts keep their registration connection open
+    boost::asio::io_service cio;
+    std::vector<tcp::socket> hosts;
+    for (int i = 0; i < rooms; ++i)
+    {
+        hosts.emplace_back(cio);
+        hosts.back().connect(endpoint);
+        lookup(hosts.back(), "h" + std::to_string(i), [i](){ return "r" + std::to_string(i); }, 1);
+    }
+    
+    std::atomic<long> total{0};
+    
+    // allocations are counted once every client has its session set up
+    std::atomic<int> warm{0};
+    std::atomic<bool> steady{false};
+    std::atomic<long> steady_total{0};
+    
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    
+    std::vector<std::thread> workers;
+    for (int c = 0; c < clients; ++c)
+    {
+        workers.emplace_back([&, c]()
+        {
+            boost::asio::io_service wio;
+            std::mt19937 rng(c);
+            std::uniform_int_distribution<int> pick(0, rooms - 1);
+            std::string from = "c" + std::to_string(c);
+            long n = 0;
+            long base = -1;
+            
+            tcp::socket socket(wio);
+            boost::system::error_code ec;
+            socket.connect(endpoint, ec);
+            
+            auto next_room = [&](){ return "r" + std::to_string(pick(rng)); };
+            while (!ec && std::chrono::steady_clock::now() < deadline)
+            {
+                if (!lookup(socket, from, next_room, depth))
+                {
+                    break;
+                }
+                
+                n += depth;
+                if (n == depth) ++warm;
+                if (base < 0 && steady) base = n;
+            }
+            
+            total += n;
+            steady_total += base < 0 ? 0 : n - base;
+        });
+    }
+    
+    while (warm < clients && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    
+    auto allocated = allocations_counted();
+    steady = true;
+    
+    for (auto& w: workers)
+    {
+        w.join();
+    }
+    
+    io.stop();
+    for (auto& t: pool)
+    {
+        t.join();
+    }
+    
+    allocated = allocations_counted() - allocated;
+    return result{double(total) / seconds, steady_total ? double(allocated) / steady_total : 0};
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    int rooms   = argc > 1 ? std::atoi(argv[1]) : 1000;
+    int clients = argc > 2 ? std::atoi(argv[2]) : 8;
+    int seconds = argc > 3 ? std::atoi(argv[3]) : 3;
+    unsigned max_threads = argc > 4 ? std::atoi(argv[4]) 
+        : std::max(1u, std::thread::hardware_concurrency());
+    int depth   = argc > 5 ? std::atoi(argv[5]) : 16;
+    
+    // the server logs every accept to stdout, so results go to stderr
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        auto r = run(threads, rooms, clients, seconds, depth);
+        std::cerr << "threads=" << threads 
+            << " lookups/s=" << std::fixed << std::setprecision(0) << r.lookups
+            << " allocs/lookup=" << std::setprecision(4) << r.allocations << std::endl;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,304 @@
+#ifndef ROOM_INDEX_H
+#define ROOM_INDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chat_structures.h"
+
+// Lock-free read side of a registry shard: the host of every room whose
+// id and host fit the inline fields, in an open addressing table of flat
+// slots. Only the shard's writer changes it, under the shard's exclusive
+// lock; readers take no lock and write nothing shared.
+//
+// Each slot is a seqlock. A writer makes its sequence odd, stores the
+// words and makes it even again; a reader copies the words and keeps them
+// only if the sequence was even and unchanged around the copy. Deletion
+// shifts the following entries back, so there are no tombstones. A reader
+// that raced a write or a shift may miss a room that is there; a miss
+// only sends it to the locked path, a hit is always a consistent copy.
+//
+// The table doubles when three quarters full. A reader may still be in
+// the old one, so replaced tables are kept until the index goes; all of
+// them together are smaller than the current one.
+class room_index
+{
+public:
+    static constexpr std::size_t id_bytes = 32;
+    static constexpr std::size_t host_id_bytes = 32;
+    static constexpr std::size_t address_bytes = 48;
+    
+    room_index() = default;
+    
+    room_index(const room_index&) = delete;
+    room_index& operator=(const room_index&) = delete;
+    
+    // Any thread. False if the room is not indexed, or a write got in the
+    // way; the caller then asks the shard under its lock.
+    bool find(std::size_t hash, const std::string& id, std::string& host_id, host_info& host) const
+    {
+        auto t = table_.load(std::memory_order_acquire);
+        if (!t || id.size() > id_bytes)
+        {
+            return false;
+        }
+        
+        auto tag = tag_of(hash);
+        for (std::size_t i = t->home(tag), n = 0; n < t->size; i = (i + 1) & t->mask, ++n)
+        {
+            words w;
+            if (!t->slots[i].read(w))
+            {
+                return false;
+            }
+            
+            if (w[tag_word] == 0)
+            {
+                return false;
+            }
+            
+            if (w[tag_word] == tag && id_size(w) == id.size()
+                && std::memcmp(bytes(w, id_word), id.data(), id.size()) == 0)
+            {
+                host_id.assign(bytes(w, host_id_word), host_id_size(w));
+                host.address.assign(bytes(w, address_word), address_size(w));
+                host.port = port(w);
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    // The rest under the shard's exclusive lock.
+    
+    // Adds or updates the room; one that no longer fits is dropped.
+    void put(std::size_t hash, const std::string& id, const std::string& host_id, const host_info& host)
+    {
+        if (id.size() > id_bytes || host_id.size() > host_id_bytes || host.address.size() > address_bytes)
+        {
+            erase(hash, id);
+            return;
+        }
+        
+        words w = {};
+        w[tag_word] = tag_of(hash);
+        w[meta_word] = std::uint64_t(id.size()) | std::uint64_t(host_id.size()) << 8
+            | std::uint64_t(host.address.size()) << 16 | std::uint64_t(host.port) << 32;
+        std::memcpy(bytes(w, id_word), id.data(), id.size());
+        std::memcpy(bytes(w, host_id_word), host_id.data(), host_id.size());
+        std::memcpy(bytes(w, address_word), host.address.data(), host.address.size());
+        
+        auto t = table_.load(std::memory_order_relaxed);
+        std::size_t i;
+        if (t && locate(*t, w[tag_word], id, i))
+        {
+            t->slots[i].write(w);
+            return;
+        }
+        
+        if (!t || 4 * (count_ + 1) > 3 * t->size)
+        {
+            t = grow(t);
+        }
+        
+        i = t->home(w[tag_word]);
+        while (t->slots[i].tag() != 0)
+        {
+            i = (i + 1) & t->mask;
+        }
+        
+        t->slots[i].write(w);
+        ++count_;
+    }
+    
+    void erase(std::size_t hash, const std::string& id)
+    {
+        auto t = table_.load(std::memory_order_relaxed);
+        std::size_t hole;
+        if (!t || !locate(*t, tag_of(hash), id, hole))
+        {
+            return;
+        }
+        
+        // entries after the hole that may live in it move back, one by one
+        // so each is always in at least one slot
+        words w;
+        for (std::size_t j = (hole + 1) & t->mask; ; j = (j + 1) & t->mask)
+        {
+            auto tag = t->slots[j].tag();
+            if (tag == 0)
+            {
+                break;
+            }
+            
+            auto home = t->home(tag);
+            if (((j - home) & t->mask) >= ((j - hole) & t->mask))
+            {
+                t->slots[j].copy(w);
+                t->slots[hole].write(w);
+                hole = j;
+            }
+        }
+        
+        t->slots[hole].write(words{});
+        --count_;
+    }
+    
+    // Room for `rooms` without growing.
+    void reserve(std::size_t rooms)
+    {
+        auto t = table_.load(std::memory_order_relaxed);
+        while (!t || 3 * t->size < 4 * rooms)
+        {
+            t = grow(t);
+        }
+    }
+
+private:
+    enum : std::size_t
+    {
+        tag_word,
+        meta_word,
+        id_word,
+        host_id_word = id_word + id_bytes / 8,
+        address_word = host_id_word + host_id_bytes / 8,
+        slot_words = address_word + address_bytes / 8
+    };
+    
+    typedef std::uint64_t words[slot_words];
+    
+    static char* bytes(words& w, std::size_t at) { return reinterpret_cast<char*>(w + at); }
+    static const char* bytes(const words& w, std::size_t at) { return reinterpret_cast<const char*>(w + at); }
+    static std::size_t id_size(const words& w) { return w[meta_word] & 0xff; }
+    static std::size_t host_id_size(const words& w) { return (w[meta_word] >> 8) & 0xff; }
+    static std::size_t address_size(const words& w) { return (w[meta_word] >> 16) & 0xff; }
+    static unsigned short port(const words& w) { return (w[meta_word] >> 32) & 0xffff; }
+    
+    // never 0, which marks a free slot
+    static std::uint64_t tag_of(std::size_t hash) { return std::uint64_t(hash) | 1; }
+    
+    struct slot
+    {
+        slot()
+        {
+            for (auto& v: w) v.store(0, std::memory_order_relaxed);
+        }
+        
+        // the writer's own view, no sequence needed
+        std::uint64_t tag() const { return w[tag_word].load(std::memory_order_relaxed); }
+        
+        void copy(words& out) const
+        {
+            for (std::size_t k = 0; k < slot_words; ++k)
+            {
+                out[k] = w[k].load(std::memory_order_relaxed);
+            }
+        }
+        
+        bool read(words& out) const
+        {
+            auto before = seq.load(std::memory_order_acquire);
+            copy(out);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return (before & 1) == 0 && seq.load(std::memory_order_relaxed) == before;
+        }
+        
+        void write(const words& in)
+        {
+            auto s = seq.load(std::memory_order_relaxed);
+            seq.store(s + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            
+            for (std::size_t k = 0; k < slot_words; ++k)
+            {
+                w[k].store(in[k], std::memory_order_relaxed);
+            }
+            
+            seq.store(s + 2, std::memory_order_release);
+        }
+        
+        std::atomic<std::uint64_t> seq{0};
+        std::atomic<std::uint64_t> w[slot_words];
+    };
+    
+    struct table
+    {
+        explicit table(std::size_t n) : size(n), mask(n - 1), slots(new slot[n]) {}
+        
+        // Fibonacci hashing, the low bits of the hash already chose the shard
+        std::size_t home(std::uint64_t tag) const
+        {
+            return std::size_t((tag * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+        }
+        
+        std::size_t size;
+        std::size_t mask;
+        std::unique_ptr<slot[]> slots;
+    };
+    
+    // the writer's lookup
+    static bool locate(const table& t, std::uint64_t tag, const std::string& id, std::size_t& at)
+    {
+        if (id.size() > id_bytes)
+        {
+            return false;
+        }
+        
+        words w;
+        for (std::size_t i = t.home(tag); ; i = (i + 1) & t.mask)
+        {
+            t.slots[i].copy(w);
+            if (w[tag_word] == 0)
+            {
+                return false;
+            }
+            
+            if (w[tag_word] == tag && id_size(w) == id.size()
+                && std::memcmp(bytes(w, id_word), id.data(), id.size()) == 0)
+            {
+                at = i;
+                return true;
+            }
+        }
+    }
+    
+    // Rehashes into a table twice the size, which readers see once it is
+    // complete.
+    table* grow(table* old)
+    {
+        std::unique_ptr<table> t(new table(old ? 2 * old->size : 16));
+        
+        if (old)
+        {
+            words w;
+            for (std::size_t k = 0; k < old->size; ++k)
+            {
+                old->slots[k].copy(w);
+                if (w[tag_word] == 0) continue;
+                
+                auto i = t->home(w[tag_word]);
+                while (t->slots[i].tag() != 0)
+                {
+                    i = (i + 1) & t->mask;
+                }
+                
+                t->slots[i].write(w);
+            }
+        }
+        
+        tables_.push_back(std::move(t));
+        table_.store(tables_.back().get(), std::memory_order_release);
+        return tables_.back().get();
+    }
+    
+    std::atomic<table*> table_{nullptr};
+    std::vector<std::unique_ptr<table>> tables_;   // the current one last
+    std::size_t count_{0};
+};
+
+#endif
@@ -0,0 +1,452 @@
+
+#include "room_journal.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+// 1 and 2 are the records of older journals, with one byte string lengths
+enum : std::uint8_t { insert_record_v1 = 1, erase_record_v1 = 2, insert_record = 3, erase_record = 4 };
+
+const char snapshot_magic[8] = {'C', 'H', 'A', 'T', 'S', 'N', 'A', 'P'};
+const std::size_t snapshot_header = 24;
+const std::size_t flush_threshold = 64 * 1024;
+
+void put_u16(std::string& out, std::uint16_t v)
+{
+    out.push_back(char(v & 0xff));
+    out.push_back(char(v >> 8));
+}
+
+void put_u64(std::string& out, std::uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out.push_back(char((v >> (8 * i)) & 0xff));
+    }
+}
+
+// Requests are far smaller than 64 KiB, a longer string is a bug upstream.
+void put_str(std::string& out, const std::string& s)
+{
+    if (s.size() > 0xffff)
+    {
+        throw std::length_error("journal string of " + std::to_string(s.size()) + " bytes");
+    }
+    
+    put_u16(out, std::uint16_t(s.size()));
+    out.append(s.data(), s.size());
+}
+
+void put_insert(std::string& out, const std::string& id, const room_entry& entry)
+{
+    out.push_back(char(insert_record));
+    put_str(out, id);
+    put_str(out, entry.host_id);
+    put_str(out, entry.host.address);
+    put_u16(out, entry.host.port);
+}
+
+void put_erase(std::string& out, const std::string& id)
+{
+    out.push_back(char(erase_record));
+    put_str(out, id);
+}
+
+struct reader
+{
+    const unsigned char* p;
+    const unsigned char* e;
+    
+    bool get_u8(std::uint8_t& v)
+    {
+        if (p == e) return false;
+        v = *p++;
+        return true;
+    }
+    
+    bool get_u16(std::uint16_t& v)
+    {
+        if (e - p < 2) return false;
+        v = std::uint16_t(p[0] | (p[1] << 8));
+        p += 2;
+        return true;
+    }
+    
+    bool get_u64(std::uint64_t& v)
+    {
+        if (e - p < 8) return false;
+        v = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            v |= std::uint64_t(p[i]) << (8 * i);
+        }
+        p += 8;
+        return true;
+    }
+    
+    bool get_str(std::string& s, bool wide)
+    {
+        std::uint16_t len;
+        std::uint8_t narrow;
+        
+        if (wide ? !get_u16(len) : !get_u8(narrow)) return false;
+        if (!wide) len = narrow;
+        
+        if (e - p < len) return false;
+        s.assign(reinterpret_cast<const char*>(p), len);
+        p += len;
+        return true;
+    }
+};
+
+void replay(reader r, room_registry& rooms)
+{
+    std::string id;
+    room_entry entry;
+    std::uint8_t type;
+    
+    while (r.get_u8(type) && type >= insert_record_v1 && type <= erase_record)
+    {
+        bool wide = type >= insert_record;
+        if (!r.get_str(id, wide))
+        {
+            return;
+        }
+        
+        if (type == insert_record || type == insert_record_v1)
+        {
+            if (!r.get_str(entry.host_id, wide) || !r.get_str(entry.host.address, wide)
+                || !r.get_u16(entry.host.port))
+            {
+                return;
+            }
+            
+            rooms.assign(id, entry);
+        }
+        else
+        {
+            rooms.erase(id);
+        }
+    }
+}
+
+struct mapped_file
+{
+    explicit mapped_file(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const unsigned char*>(addr);
+                size = st.st_size;
+            }
+        }
+        
+        ::close(fd);
+    }
+    
+    ~mapped_file()
+    {
+        if (data) ::munmap(const_cast<unsigned char*>(data), size);
+    }
+    
+    reader read(std::size_t offset = 0) const { return reader{data + offset, data + size}; }
+    
+    const unsigned char* data{nullptr};
+    std::size_t size{0};
+};
+
+void write_all(int fd, const char* p, std::size_t n, const std::string& what)
+{
+    while (n > 0)
+    {
+        auto r = ::write(fd, p, n);
+        if (r < 0)
+        {
+            if (errno == EINTR) continue;
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+        
+        p += r;
+        n -= r;
+    }
+}
+
+std::vector<std::uint64_t> list_segments(const std::string& dir)
+{
+    std::vector<std::uint64_t> segments;
+    
+    if (DIR* d = ::opendir(dir.c_str()))
+    {
+        while (dirent* e = ::readdir(d))
+        {
+            unsigned long long n;
+            char tail[8];
+            if (std::sscanf(e->d_name, "rooms.%llu.%7s", &n, tail) == 2
+                && std::strcmp(tail, "wal") == 0)
+            {
+                segments.push_back(n);
+            }
+        }
+        
+        ::closedir(d);
+    }
+    
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+}
+
+room_journal::room_journal(const std::string& dir) :
+    dir_(dir)
+{
+    if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        throw std::system_error(errno, std::generic_category(), dir_);
+    }
+}
+
+room_journal::~room_journal()
+{
+    try { flush(); } catch (std::exception&) {}
+    
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+std::string room_journal::segment_path(std::uint64_t n) const
+{
+    return dir_ + "/rooms." + std::to_string(n) + ".wal";
+}
+
+int room_journal::open_segment(std::uint64_t n) const
+{
+    auto path = segment_path(n);
+    
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    
+    return fd;
+}
+
+std::size_t room_journal::recover(room_registry& rooms)
+{
+    std::uint64_t first = 0;
+    
+    {
+        mapped_file snap(dir_ + "/rooms.snap");
+        if (snap.size >= snapshot_header
+            && std::memcmp(snap.data, snapshot_magic, sizeof(snapshot_magic)) == 0)
+        {
+            auto r = snap.read(sizeof(snapshot_magic));
+            std::uint64_t count = 0;
+            r.get_u64(first);
+            r.get_u64(count);
+            
+            rooms.reserve(count);
+            replay(r, rooms);
+        }
+    }
+    
+    auto last = first;
+    for (auto n: list_segments(dir_))
+    {
+        if (n < first)
+        {
+            ::unlink(segment_path(n).c_str());
+            continue;
+        }
+        
+        mapped_file segment(segment_path(n));
+        replay(segment.read(), rooms);
+        last = n;
+    }
+    
+    // never append behind a possibly torn tail
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    fd_ = open_segment(last + 1);
+    segment_ = last + 1;
+    
+    return rooms.size();
+}
+
+void room_journal::inserted(const std::string& id, const room_entry& entry)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto before = pending_.size();
+    put_insert(pending_, id, entry);
+    if (before < flush_threshold && pending_.size() >= flush_threshold)
+    {
+        ready_.notify_one();
+    }
+}
+
+void room_journal::erased(const std::string& id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    auto before = pending_.size();
+    put_erase(pending_, id);
+    if (before < flush_threshold && pending_.size() >= flush_threshold)
+    {
+        ready_.notify_one();
+    }
+}
+
+void room_journal::wait(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait_for(lock, timeout, [this]() { return pending_.size() >= flush_threshold; });
+}
+
+void room_journal::flush()
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    flush_locked();
+}
+
+// Under write_mutex_. The records are taken out under mutex_ and written
+// without it, so the shards never wait for the disk. Without a segment
+// they stay pending.
+void room_journal::flush_locked()
+{
+    if (fd_ < 0)
+    {
+        throw std::logic_error("journal has no segment, recover() first");
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        writing_.swap(pending_);
+    }
+    
+    try
+    {
+        if (!writing_.empty())
+        {
+            write_all(fd_, writing_.data(), writing_.size(), segment_path(segment_));
+        }
+    }
+    catch (...)
+    {
+        writing_.clear();
+        throw;
+    }
+    
+    writing_.clear();
+}
+
+void room_journal::snapshot(const room_registry& rooms)
+{
+    std::uint64_t n;
+    
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        flush_locked();
+        
+        if (::fsync(fd_) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), segment_path(segment_));
+        }
+        
+        // the old segment stays current unless the new one opens
+        n = segment_ + 1;
+        int fd = open_segment(n);
+        ::close(fd_);
+        fd_ = fd;
+        segment_ = n;
+    }
+    
+    // Changes racing with the scan below land both in the snapshot and in
+    // segment n. Replaying n on top of the snapshot is harmless because every
+    // record fully determines the state of its room.
+    auto tmp = dir_ + "/rooms.snap.tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), tmp);
+    }
+    
+    try
+    {
+        std::string out(snapshot_magic, sizeof(snapshot_magic));
+        put_u64(out, n);
+        put_u64(out, 0);
+        
+        // each shard is copied out under its lock and written after it
+        std::uint64_t count = 0;
+        for (std::size_t i = 0; i < rooms.shard_count(); ++i)
+        {
+            rooms.for_each(i, [&](const std::string& id, const room_entry& entry)
+                {
+                    put_insert(out, id, entry);
+                    ++count;
+                });
+            
+            if (out.size() >= 16 * flush_threshold)
+            {
+                write_all(fd, out.data(), out.size(), tmp);
+                out.clear();
+            }
+        }
+        
+        write_all(fd, out.data(), out.size(), tmp);
+        
+        out.clear();
+        put_u64(out, count);
+        if (::pwrite(fd, out.data(), out.size(), sizeof(snapshot_magic) + 8) != ssize_t(out.size())
+            || ::fsync(fd) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), tmp);
+        }
+    }
+    catch (...)
+    {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    
+    ::close(fd);
+    
+    if (::rename(tmp.c_str(), (dir_ + "/rooms.snap").c_str()) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), tmp);
+    }
+    
+    for (auto old: list_segments(dir_))
+    {
+        if (old < n)
+        {
+            ::unlink(segment_path(old).c_str());
+        }
+    }
+}
@@ -0,0 +1,71 @@
+
+#ifndef ROOM_JOURNAL_H
+#define ROOM_JOURNAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "room_registry.h"
+
+// Persists the room directory as a snapshot plus numbered write-ahead log
+// segments in `dir`:
+//
+//   rooms.snap        magic, segment number, room count, insert records
+//   rooms.<n>.wal     insert/erase records appended after snapshot n
+//
+// Records are a type byte followed by length-prefixed strings, so replay is
+// a single pass over the mapped files. A torn record at the tail of the last
+// segment ends its replay.
+//
+// The observer calls run under the lock of a registry shard, so they only
+// append to a buffer; flush() writes it out from another thread.
+class room_journal : public room_observer
+{
+public:
+    explicit room_journal(const std::string& dir);
+    ~room_journal();
+    
+    room_journal(const room_journal&) = delete;
+    room_journal& operator=(const room_journal&) = delete;
+    
+    // Loads the snapshot and replays every later segment into `rooms`, then
+    // starts a fresh segment for new records. Returns the number of rooms.
+    std::size_t recover(room_registry& rooms);
+    
+    void inserted(const std::string& id, const room_entry& entry) override;
+    void erased(const std::string& id) override;
+    
+    // Returns after `timeout`, or earlier once enough records are buffered
+    // to be worth a write.
+    void wait(std::chrono::milliseconds timeout);
+    
+    // Hands buffered records to the OS.
+    void flush();
+    
+    // Starts a new segment, writes a snapshot of `rooms` covering everything
+    // before it and removes the segments the snapshot supersedes.
+    void snapshot(const room_registry& rooms);
+
+private:
+    std::string segment_path(std::uint64_t n) const;
+    int open_segment(std::uint64_t n) const;
+    void flush_locked();
+    
+    std::string dir_;
+    
+    // guards pending_, the only state the observer calls touch
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::string pending_;
+    
+    // guards the segment and the records being written to it
+    std::mutex write_mutex_;
+    std::string writing_;
+    int fd_{-1};
+    std::uint64_t segment_{0};
+};
+
+#endif
@@ -0,0 +1,390 @@
+
+#include "room_registry.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// What a lookup answers with. The successors stay behind, copying them
+// would allocate under the shard lock.
+void copy_host(const room_entry& from, room_entry& to)
+{
+    to.host_id = from.host_id;
+    to.host = from.host;
+}
+
+}
+
+room_registry::room_registry(std::size_t shards)
+{
+    std::size_t n = 1;
+    while (n < shards) n <<= 1;
+    
+    shards_ = make_aligned_array<shard>(n);
+    mask_ = n - 1;
+}
+
+void room_registry::arm(shard& s, room_map::iterator it)
+{
+    it->second.id = &it->first;
+    
+    if (lease_)
+    {
+        s.leases.arm(it->second, lease_);
+    }
+}
+
+// after the host of the room changed
+void room_registry::index(shard& s, room_map::iterator it)
+{
+    s.index.put(hash_(it->first), it->first, it->second.entry.host_id, it->second.entry.host);
+}
+
+void room_registry::remove(shard& s, room_map::iterator it)
+{
+    s.leases.cancel(it->second);
+    s.index.erase(hash_(it->first), it->first);
+    
+    if (observer_)
+    {
+        observer_->erased(it->first);
+    }
+    
+    s.rooms.erase(it);
+}
+
+bool room_registry::hand_over(shard& s, room_map::iterator it)
+{
+    auto& entry = it->second.entry;
+    if (entry.successors.empty())
+    {
+        return false;
+    }
+    
+    entry.host_id = std::move(entry.successors.front().id);
+    entry.host = std::move(entry.successors.front().host);
+    entry.successors.erase(entry.successors.begin());
+    arm(s, it);
+    index(s, it);
+    
+    if (observer_)
+    {
+        observer_->inserted(it->first, entry);
+    }
+    return true;
+}
+
+bool room_registry::find_or_insert(const std::string& id, room_entry& entry)
+{
+    auto hash = hash_(id);
+    auto& s = shard_for(hash);
+    
+    if (s.index.find(hash, id, entry.host_id, entry.host))
+    {
+        return true;
+    }
+    
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(s.mutex);
+        auto it = s.rooms.find(id);
+        if (it != s.rooms.end())
+        {
+            copy_host(it->second.entry, entry);
+            return true;
+        }
+    }
+    
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto r = s.rooms.emplace(id, room_slot());
+    if (!r.second)
+    {
+        // someone registered the room in between
+        copy_host(r.first->second.entry, entry);
+        return true;
+    }
+    
+    r.first->second.entry = entry;
+    arm(s, r.first);
+    index(s, r.first);
+    
+    if (observer_)
+    {
+        observer_->inserted(id, entry);
+    }
+    
+    return false;
+}
+
+void room_registry::find_or_insert(const std::vector<std::string>& ids, 
+    const room_entry& entry, std::vector<room_lookup>& result)
+{
+    result.assign(ids.size(), room_lookup{false, entry});
+    
+    // the rooms the indexes know need no lock, the others are grouped
+    std::vector<std::pair<std::size_t, std::size_t>> order;     // shard, index
+    order.reserve(ids.size());
+    for (std::size_t i = 0; i < ids.size(); ++i)
+    {
+        auto hash = hash_(ids[i]);
+        auto& r = result[i];
+        if (shard_for(hash).index.find(hash, ids[i], r.entry.host_id, r.entry.host))
+        {
+            r.found = true;
+            continue;
+        }
+        
+        order.emplace_back(hash & mask_, i);
+    }
+    
+    std::sort(order.begin(), order.end());
+    
+    for (auto b = order.begin(); b != order.end(); )
+    {
+        auto& s = shards_[b->first];
+        auto e = std::find_if(b, order.end(), 
+            [b](const std::pair<std::size_t, std::size_t>& o) { return o.first != b->first; });
+        
+        bool missing = false;
+        {
+            std::shared_lock<std::shared_timed_mutex> lock(s.mutex);
+            for (auto o = b; o != e; ++o)
+            {
+                auto it = s.rooms.find(ids[o->second]);
+                if (it != s.rooms.end())
+                {
+                    result[o->second].found = true;
+                    copy_host(it->second.entry, result[o->second].entry);
+                }
+                else
+                {
+                    missing = true;
+                }
+            }
+        }
+        
+        if (missing)
+        {
+            std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+            for (auto o = b; o != e; ++o)
+            {
+                auto& r = result[o->second];
+                if (r.found) continue;
+                
+                auto& id = ids[o->second];
+                auto it = s.rooms.emplace(id, room_slot());
+                if (!it.second)
+                {
+                    r.found = true;
+                    copy_host(it.first->second.entry, r.entry);
+                    continue;
+                }
+                
+                it.first->second.entry = entry;
+                arm(s, it.first);
+                index(s, it.first);
+                
+                if (observer_)
+                {
+                    observer_->inserted(id, entry);
+                }
+            }
+        }
+        
+        b = e;
+    }
+}
+
+bool room_registry::find(const std::string& id, room_entry& entry) const
+{
+    auto& s = shard_for(hash_(id));
+    
+    std::shared_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto it = s.rooms.find(id);
+    if (it == s.rooms.end())
+    {
+        return false;
+    }
+    
+    entry = it->second.entry;
+    return true;
+}
+
+bool room_registry::refresh(const std::string& id, const room_entry& entry)
+{
+    auto& s = shard_for(hash_(id));
+    
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto r = s.rooms.emplace(id, room_slot());
+    if (r.second)
+    {
+        r.first->second.entry = entry;
+        index(s, r.first);
+        
+        if (observer_)
+        {
+            observer_->inserted(id, entry);
+        }
+    }
+    else if (r.first->second.entry.host_id != entry.host_id)
+    {
+        auto& current = r.first->second.entry;
+        auto next = std::find_if(current.successors.begin(), current.successors.end(),
+            [&entry](const successor& s) { return s.id == entry.host_id; });
+        if (next == current.successors.end())
+        {
+            return false;
+        }
+        
+        // a standby took over before the old host's lease ran out
+        current.successors.erase(current.successors.begin(), next + 1);
+        current.host_id = entry.host_id;
+        current.host = entry.host;
+        index(s, r.first);
+        
+        if (observer_)
+        {
+            observer_->inserted(id, current);
+        }
+    }
+    else if (r.first->second.entry.host.address != entry.host.address
+        || r.first->second.entry.host.port != entry.host.port)
+    {
+        // host came back on another address
+        r.first->second.entry.host = entry.host;
+        index(s, r.first);
+        
+        if (observer_)
+        {
+            observer_->inserted(id, entry);
+        }
+    }
+    
+    arm(s, r.first);
+    return true;
+}
+
+bool room_registry::erase(const std::string& id, const std::string& host_id)
+{
+    auto& s = shard_for(hash_(id));
+    
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto it = s.rooms.find(id);
+    if (it == s.rooms.end() || it->second.entry.host_id != host_id)
+    {
+        return false;
+    }
+    
+    remove(s, it);
+    return true;
+}
+
+bool room_registry::set_successors(const std::string& id, const std::string& host_id,
+    const std::vector<successor>& successors)
+{
+    auto& s = shard_for(hash_(id));
+    
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto it = s.rooms.find(id);
+    if (it == s.rooms.end() || it->second.entry.host_id != host_id)
+    {
+        return false;
+    }
+    
+    it->second.entry.successors = successors;
+    return true;
+}
+
+bool room_registry::release(const std::string& id, const std::string& host_id)
+{
+    auto& s = shard_for(hash_(id));
+    
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto it = s.rooms.find(id);
+    if (it == s.rooms.end() || it->second.entry.host_id != host_id)
+    {
+        return false;
+    }
+    
+    if (!hand_over(s, it))
+    {
+        remove(s, it);
+    }
+    return true;
+}
+
+void room_registry::assign(const std::string& id, const room_entry& entry)
+{
+    auto& s = shard_for(hash_(id));
+    
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto it = s.rooms.emplace(id, room_slot()).first;
+    it->second.entry = entry;
+    arm(s, it);
+    index(s, it);
+    
+    if (observer_)
+    {
+        observer_->inserted(id, entry);
+    }
+}
+
+bool room_registry::erase(const std::string& id)
+{
+    auto& s = shard_for(hash_(id));
+    
+    std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+    auto it = s.rooms.find(id);
+    if (it == s.rooms.end())
+    {
+        return false;
+    }
+    
+    remove(s, it);
+    return true;
+}
+
+std::size_t room_registry::expire()
+{
+    std::size_t evicted = 0;
+    
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+        auto& s = shards_[i];
+        
+        std::unique_lock<std::shared_timed_mutex> lock(s.mutex);
+        s.leases.advance([&](timer_hook& lease)
+            {
+                auto it = s.rooms.find(*static_cast<room_slot&>(lease).id);
+                if (!hand_over(s, it))
+                {
+                    remove(s, it);
+                    ++evicted;
+                }
+            });
+    }
+    
+    return evicted;
+}
+
+void room_registry::reserve(std::size_t rooms)
+{
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(shards_[i].mutex);
+        shards_[i].rooms.reserve(rooms / (mask_ + 1) + 1);
+        shards_[i].index.reserve(rooms / (mask_ + 1) + 1);
+    }
+}
+
+std::size_t room_registry::size() const
+{
+    std::size_t n = 0;
+    for (std::size_t i = 0; i <= mask_; ++i)
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(shards_[i].mutex);
+        n += shards_[i].rooms.size();
+    }
+    
+    return n;
+}
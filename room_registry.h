@@ -0,0 +1,148 @@
+
+#ifndef ROOM_REGISTRY_H
+#define ROOM_REGISTRY_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cache_aligned.h"
+#include "chat_structures.h"
+#include "room_index.h"
+#include "timer_wheel.h"
+
+struct room_entry
+{
+    std::string host_id;
+    host_info host;
+    
+    // take the room over in this order when the host goes away; kept in
+    // memory only, the host announces them again with its next heartbeat
+    std::vector<successor> successors;
+};
+
+struct room_lookup
+{
+    bool found;
+    room_entry entry;
+};
+
+// Notified of every change while the owning shard is still locked, so the
+// order of notifications for one room matches the order of the changes.
+struct room_observer
+{
+    virtual ~room_observer() {}
+    virtual void inserted(const std::string& id, const room_entry& entry) = 0;
+    virtual void erased(const std::string& id) = 0;
+};
+
+// Room directory split into independently locked shards. Each shard keeps
+// its rooms in a map, which owns them, and the hosts of the rooms with
+// short enough fields in a room_index as well; lookups of existing rooms
+// are answered from the index without taking any lock, and only fall back
+// to the shard's shared lock for the others. Inserts and erases lock one
+// shard exclusively and update both.
+//
+// When leases are enabled every room carries a timer in its shard's wheel;
+// hosts keep it alive with refresh() and expire() evicts the rooms whose
+// lease ran out without looking at any other room.
+class room_registry
+{
+public:
+    explicit room_registry(std::size_t shards = 64);
+    
+    // Lease length in expire() ticks, 0 disables eviction.
+    void set_lease(std::uint64_t ticks) { lease_ = ticks; }
+    
+    // Registers `entry` as host of `id` unless the room already exists.
+    // Returns true if the room was found, `entry` then holds its host; its
+    // successors are left as they were.
+    bool find_or_insert(const std::string& id, room_entry& entry);
+    
+    // Batch form: resolves every id, registering `entry` as host of the
+    // unknown ones. Ids are grouped by shard so each shard is locked once.
+    // Found rooms come without their successors.
+    void find_or_insert(const std::vector<std::string>& ids, const room_entry& entry,
+        std::vector<room_lookup>& result);
+    
+    // With the successors, so always under the shard's shared lock.
+    bool find(const std::string& id, room_entry& entry) const;
+    
+    // Renews the lease of a room hosted by `entry.host_id`, registering the
+    // room again if it is unknown. A successor of the current host takes
+    // the room over. Returns false if another host owns it.
+    bool refresh(const std::string& id, const room_entry& entry);
+    
+    // Replaces the successors of a room hosted by `host_id`.
+    bool set_successors(const std::string& id, const std::string& host_id,
+        const std::vector<successor>& successors);
+    
+    // Removes the room only if it is still hosted by `host_id`.
+    bool erase(const std::string& id, const std::string& host_id);
+    
+    // Like erase(), but a room with successors goes to the first of them.
+    bool release(const std::string& id, const std::string& host_id);
+    
+    // Unconditional updates, used when restoring persisted state.
+    void assign(const std::string& id, const room_entry& entry);
+    bool erase(const std::string& id);
+    
+    // Advances every lease wheel by one tick, returns the evicted count.
+    // Rooms with successors are handed over instead of evicted.
+    std::size_t expire();
+    
+    void observe(room_observer* observer) { observer_ = observer; }
+    
+    void reserve(std::size_t rooms);
+    std::size_t size() const;
+    
+    std::size_t shard_count() const { return mask_ + 1; }
+    
+    // Calls `f` with every room of one shard, under the shard's shared
+    // lock; it should only copy what it needs.
+    template <typename F>
+    void for_each(std::size_t shard, F f) const
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(shards_[shard].mutex);
+        for (auto& room: shards_[shard].rooms)
+        {
+            f(room.first, room.second.entry);
+        }
+    }
+
+private:
+    struct room_slot : timer_hook
+    {
+        room_entry entry;
+        const std::string* id{nullptr};
+    };
+    
+    using room_map = std::unordered_map<std::string, room_slot>;
+    
+    struct alignas(64) shard
+    {
+        mutable std::shared_timed_mutex mutex;
+        room_map rooms;
+        room_index index;
+        timer_wheel leases;
+    };
+    
+    shard& shard_for(std::size_t hash) const { return shards_[hash & mask_]; }
+    
+    void arm(shard& s, room_map::iterator it);
+    void index(shard& s, room_map::iterator it);
+    void remove(shard& s, room_map::iterator it);
+    bool hand_over(shard& s, room_map::iterator it);
+    
+    aligned_array<shard> shards_;
+    std::size_t mask_;
+    std::hash<std::string> hash_;
+    std::uint64_t lease_{0};
+    room_observer* observer_{nullptr};
+};
+
+#endif
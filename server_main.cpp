@@ -0,0 +1,179 @@
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "chat_log.h"
+#include "chat_server.h"
+#include "room_journal.h"
+
+namespace
+{
+
+const auto journal_flush_interval = std::chrono::milliseconds(100);
+const auto snapshot_interval = std::chrono::minutes(1);
+
+const auto lease_tick = std::chrono::milliseconds(100);
+const int default_lease = 30;      // seconds
+
+void maintain(room_journal& journal, const room_registry& rooms)
+{
+    auto next_snapshot = std::chrono::steady_clock::now() + snapshot_interval;
+    
+    for (;;)
+    {
+        journal.wait(journal_flush_interval);
+        
+        try
+        {
+            if (std::chrono::steady_clock::now() >= next_snapshot)
+            {
+                next_snapshot += snapshot_interval;
+                journal.snapshot(rooms);
+            }
+            else
+            {
+                journal.flush();
+            }
+        }
+        catch (std::exception& e)
+        {
+            LOG_ERROR("journal: {}", e.what());
+        }
+    }
+}
+
+void expire_leases(boost::asio::steady_timer& timer, room_registry& rooms)
+{
+    timer.expires_from_now(lease_tick);
+    timer.async_wait(
+        [&timer, &rooms](boost::system::error_code ec)
+        {
+            if (!ec)
+            {
+                rooms.expire();
+                expire_leases(timer, rooms);
+            }
+        });
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        int arg = 1;
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        const char* data_dir = nullptr;
+        int lease = default_lease;
+        int admin_port = 0;
+        
+        for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+        {
+            if (std::strcmp(argv[arg], "-t") == 0)
+            {
+                threads = std::max(1, std::atoi(argv[arg + 1]));
+            }
+            else if (std::strcmp(argv[arg], "-d") == 0)
+            {
+                data_dir = argv[arg + 1];
+            }
+            else if (std::strcmp(argv[arg], "-l") == 0)
+            {
+                lease = std::max(0, std::atoi(argv[arg + 1]));
+            }
+            else if (std::strcmp(argv[arg], "-a") == 0)
+            {
+                admin_port = std::atoi(argv[arg + 1]);
+            }
+            else if (std::strcmp(argv[arg], "-v") == 0)
+            {
+                log_level level;
+                if (!parse_log_level(argv[arg + 1], level))
+                {
+                    arg = argc;
+                    break;
+                }
+                
+                set_log_level(level);
+            }
+            else
+            {
+                break;
+            }
+        }
+        
+        if (arg >= argc)
+        {
+            std::cerr << "Usage: chat_server [-t <threads>] [-d <data_dir>] [-l <lease_seconds>] [-a <admin_port>]"
+                " [-v debug|info|warning|error|none] <port> [<port> ...]\n";
+            return 1;
+        }
+        
+        boost::asio::io_service io;
+        room_registry rooms;
+        server_metrics metrics;
+        rooms.set_lease(lease * (std::chrono::seconds(1) / lease_tick));
+        
+        std::unique_ptr<room_journal> journal;
+        if (data_dir)
+        {
+            journal.reset(new room_journal(data_dir));
+            
+            auto start = std::chrono::steady_clock::now();
+            auto count = journal->recover(rooms);
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+            
+            LOG_INFO("restored {} rooms in {} ms", count, elapsed.count());
+            
+            rooms.observe(journal.get());
+            std::thread(maintain, std::ref(*journal), std::cref(rooms)).detach();
+        }
+        
+        std::list<chat_server> servers;
+        for (; arg < argc; ++arg)
+        {
+            tcp::endpoint endpoint(tcp::v4(), std::atoi(argv[arg]));
+            servers.emplace_back(io, endpoint, rooms, metrics);
+        }
+        
+        std::unique_ptr<admin_server> admin;
+        if (admin_port)
+        {
+            admin.reset(new admin_server(io, tcp::endpoint(tcp::v4(), admin_port), rooms, metrics));
+        }
+        
+        boost::asio::steady_timer lease_timer(io);
+        if (lease)
+        {
+            expire_leases(lease_timer, rooms);
+        }
+        
+        // every acceptor and session shares one io_service run by the whole pool
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i)
+        {
+            pool.emplace_back([&io](){ io.run(); });
+        }
+        
+        io.run();
+        
+        for (auto& t: pool)
+        {
+            t.join();
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+    
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <iomanip>
+
+#include "server_metrics.h"
+
+namespace
+{
+
+std::atomic<std::uint64_t> instances{0};
+
+}
+
+server_metrics::server_metrics() :
+    id_(++instances),
+    last_report_(clock_type::now())
+{}
+
+server_metrics::counters& server_metrics::attach()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    // the thread counted here before, for another instance in between
+    auto me = std::this_thread::get_id();
+    for (auto& c: threads_)
+    {
+        if (c->thread == me)
+        {
+            return *c;
+        }
+    }
+    
+    threads_.push_back(make_aligned<counters>(me));
+    return *threads_.back();
+}
+
+server_metrics::totals server_metrics::read() const
+{
+    totals t;
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& c: threads_)
+    {
+        t.accepts += c->accepts.load(std::memory_order_relaxed);
+        t.accept_errors += c->accept_errors.load(std::memory_order_relaxed);
+        t.sessions_opened += c->sessions_opened.load(std::memory_order_relaxed);
+        t.sessions_closed += c->sessions_closed.load(std::memory_order_relaxed);
+        t.batches += c->batches.load(std::memory_order_relaxed);
+        t.creates += c->creates.load(std::memory_order_relaxed);
+        t.finds += c->finds.load(std::memory_order_relaxed);
+    }
+    
+    return t;
+}
+
+void server_metrics::report(std::ostream& os, std::size_t rooms)
+{
+    auto t = read();
+    
+    latency_histogram lookup_ns;
+    auto now = clock_type::now();
+    double seconds = 0;
+    std::uint64_t lookups = t.creates + t.finds;
+    std::uint64_t previous = 0;
+    
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& c: threads_)
+        {
+            lookup_ns.merge(c->lookup_ns);
+        }
+        
+        seconds = std::chrono::duration<double>(now - last_report_).count();
+        previous = last_lookups_;
+        last_report_ = now;
+        last_lookups_ = lookups;
+    }
+    
+    auto us = [](std::uint64_t ns) { return ns / 1000.0; };
+    
+    // a session opened on one thread may close on another, only the sum
+    // of both is meaningful
+    os << "rooms " << rooms << "\n"
+        << "sessions " << t.sessions_opened - t.sessions_closed << "\n"
+        << "accepts " << t.accepts << "\n"
+        << "accept_errors " << t.accept_errors << "\n"
+        << "lookups " << lookups << "\n"
+        << "creates " << t.creates << "\n"
+        << "finds " << t.finds << "\n"
+        << "batches " << t.batches << "\n"
+        << std::fixed << std::setprecision(1)
+        << "lookups_per_sec " << (seconds > 0 ? (lookups - previous) / seconds : 0) << "\n"
+        << std::setprecision(3)
+        << "lookup_p50_us " << us(lookup_ns.percentile(0.5)) << "\n"
+        << "lookup_p99_us " << us(lookup_ns.percentile(0.99)) << "\n"
+        << "lookup_p999_us " << us(lookup_ns.percentile(0.999)) << "\n"
+        << "lookup_max_us " << us(lookup_ns.max()) << "\n";
+}
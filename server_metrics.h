@@ -0,0 +1,112 @@
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "cache_aligned.h"
+#include "latency_histogram.h"
+
+// Directory counters. Every thread counts into a block of its own, so the
+// lookup path never writes a cache line another thread writes; reading
+// adds the blocks up. A block outlives its thread, so nothing counted is
+// lost when a pool thread exits.
+class server_metrics
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+    
+    server_metrics();
+    
+    server_metrics(const server_metrics&) = delete;
+    server_metrics& operator=(const server_metrics&) = delete;
+    
+    void accepted() { bump(local().accepts); }
+    void accept_failed() { bump(local().accept_errors); }
+    void session_opened() { bump(local().sessions_opened); }
+    void session_closed() { bump(local().sessions_closed); }
+    void batch() { bump(local().batches); }
+    
+    // one room resolved, `found` or created
+    void resolved(bool found) { bump(found ? local().finds : local().creates); }
+    
+    // A single room lookup, from the decoded request to the answer. In
+    // nanoseconds, lookups take far less than a microsecond; ones over the
+    // histogram's 4.3 seconds count as that.
+    void lookup_time(clock_type::duration d)
+    {
+        local().lookup_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+    
+    struct totals
+    {
+        std::uint64_t accepts{0};
+        std::uint64_t accept_errors{0};
+        std::uint64_t sessions_opened{0};
+        std::uint64_t sessions_closed{0};
+        std::uint64_t batches{0};
+        std::uint64_t creates{0};
+        std::uint64_t finds{0};
+    };
+    
+    totals read() const;
+    
+    // "<name> <value>" lines. `rooms` is the registered room count; the
+    // lookup rate is over the time since the previous report.
+    void report(std::ostream& os, std::size_t rooms);
+
+private:
+    struct alignas(64) counters
+    {
+        explicit counters(std::thread::id t) : thread(t) {}
+        
+        std::thread::id thread;
+        std::atomic<std::uint64_t> accepts{0};
+        std::atomic<std::uint64_t> accept_errors{0};
+        std::atomic<std::uint64_t> sessions_opened{0};
+        std::atomic<std::uint64_t> sessions_closed{0};
+        std::atomic<std::uint64_t> batches{0};
+        std::atomic<std::uint64_t> creates{0};
+        std::atomic<std::uint64_t> finds{0};
+        latency_histogram lookup_ns;
+    };
+    
+    // only the owning thread writes, so no read-modify-write is needed
+    static void bump(std::atomic<std::uint64_t>& c)
+    {
+        c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    
+    counters& local()
+    {
+        // keyed by instance number, an address may be reused
+        thread_local std::uint64_t owner = 0;
+        thread_local counters* mine = nullptr;
+        
+        if (owner != id_)
+        {
+            mine = &attach();
+            owner = id_;
+        }
+        
+        return *mine;
+    }
+    
+    counters& attach();
+    
+    const std::uint64_t id_;
+    
+    mutable std::mutex mutex_;
+    std::vector<aligned_ptr<counters>> threads_;
+    
+    // where the previous report left off
+    clock_type::time_point last_report_;
+    std::uint64_t last_lookups_{0};
+};
+
+#endif
@@ -1,109 +1,234 @@
 
+#include <algorithm>
+
 #include "chat_server.h"
 #include "chat_structures.h"
-
-#define PRINT_DEBUG(...) printf(__VA_ARGS__)
+#include "chat_binary.h"
+#include "chat_log.h"
 
 void server_session::do_read()
 {
-    auto self(shared_from_this());
-    socket_.async_read_some(boost::asio::buffer(buf_.data(), buf_.capacity()),
-        [this, self](boost::system::error_code ec, std::size_t length)
+    socket_.async_read_some(boost::asio::buffer(in_.tail(), in_.tail_size()), make_alloc_handler(io_memory_,
+        [this, self = shared_from_this()](boost::system::error_code ec, std::size_t length)
         {
             if (ec)
             {
-                if (!id_.empty())
-                {
-                    rooms_.erase(id_);
-                }
-                
-                socket_.close();
+                close();
                 return;
             }
             
-            auto r = buf_.consume(length);
+            in_.commit(length);
             
-            if (r == buffer_t::intermediate)
+            boost::string_view frame;
+            while (in_.next(frame))
             {
-                do_read();
-            }
-            else if (r == buffer_t::ok)
-            {
-                if (state_ == accept_request)
+                if (!handle(frame))
                 {
-                    connect_req req;
-                    if (decode_connect_req(buf_, req))
-                    {
-                        connect_res res {0};
-                        auto found = rooms_.find(req.room) != rooms_.end();
-                        auto& room = rooms_[req.room];
-                        
-                        if (found)
-                        {
-                            PRINT_DEBUG ("Room %s found\n", req.room.c_str());
-                            res.host = room.host;
-                            state_ = close_connection;
-                        }
-                        else
-                        {
-                            PRINT_DEBUG ("Room %s created\n", req.room.c_str());
-                            state_ = accept_info;
-                            
-                            id_ = req.room;
-                            room.host_id = req.from;
-                            room.host = req.host;
-                        }
-                        
-                        res.host_id = room.host_id;
-                        
-                        // send response
-                        buf_.reset();
-                        if (encode_connection_res(res, buf_))
-                        {
-                            do_write();
-                        }
-                    }
-                    else
-                    {
-                        socket_.close();
-                    }
-                }
-                else if (state_ == accept_info)
-                {
-                    // todo: handle history here
+                    close();
+                    return;
                 }
             }
+            
+            if (in_.full())
+            {
+                close();
+            }
+            else if (!out_.empty())
+            {
+                do_write();
+            }
             else
             {
-                socket_.close();
+                do_read();
             }
-        });
+        }));
 }   
 
-void server_session::do_write()
+namespace
+{
+
+bool encode_text(const connect_res& res, std::string& out)
+{
+    return encode_connection_res(res, out);
+}
+
+bool encode_text(const connect_batch_res& res, std::string& out)
 {
-    auto self(shared_from_this());
-    boost::asio::async_write(socket_, boost::asio::buffer(buf_.data(), buf_.length()),
-        [this, self](boost::system::error_code ec, std::size_t)
+    return encode_connect_batch_res(res, out);
+}
+
+}
+
+bool server_session::handle(boost::string_view frame)
+{
+    connect_req_view req;
+    connect_batch_req batch;
+    heartbeat hb;
+    standby sb;
+    
+    binary_header header;
+    if (decode_header(frame, header))
+    {
+        switch (header.type)
         {
-            if (!ec)
-            {
-                if (state_ == close_connection)
-                {
-                    // Initiate graceful connection closure.
-                    boost::system::error_code ignored_ec;
-                    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both,
-                        ignored_ec);
-                }
-                else
-                {
-                    buf_.reset();
-                    do_read();
-                }
-            }
+        case pdu_type::connect_req:
+            return decode_binary(frame, req) && reply(lookup(req), &header);
+        case pdu_type::connect_batch_req:
+            return decode_binary(frame, batch) && reply(lookup(batch), &header);
+        case pdu_type::heartbeat:
+            return decode_binary(frame, hb) && renew(hb);
+        case pdu_type::standby:
+            return decode_binary(frame, sb) && succession(sb);
+        default:
+            return false;
+        }
+    }
+    
+    if (decode_connect_req(frame, req))
+    {
+        return reply(lookup(req), nullptr);
+    }
+    else if (decode_connect_batch_req(frame, batch))
+    {
+        return reply(lookup(batch), nullptr);
+    }
+    else if (decode_heartbeat(frame, hb))
+    {
+        return renew(hb);
+    }
+    else if (decode_standby(frame, sb))
+    {
+        return succession(sb);
+    }
+    
+    return false;
+}
+
+template <typename Response>
+bool server_session::reply(const Response& res, const binary_header* request)
+{
+    if (request)
+    {
+        return encode_binary(res, out_, request->seq);
+    }
+    
+    auto size = out_.size();
+    if (!encode_text(res, out_))
+    {
+        out_.resize(size);
+        return false;
+    }
+    
+    out_.push_back('\n');
+    return true;
+}
+
+const connect_res& server_session::lookup(const connect_req_view& req)
+{
+    // reuse the strings of the previous lookup, most ids fit their capacity
+    key_.assign(req.room.data(), req.room.size());
+    room_.host_id.assign(req.from.data(), req.from.size());
+    room_.host.address.assign(req.host.address.data(), req.host.address.size());
+    room_.host.port = req.host.port;
+    
+    res_.status = 0;
+    
+    auto start = server_metrics::clock_type::now();
+    bool found = rooms_.find_or_insert(key_, room_);
+    metrics_.lookup_time(server_metrics::clock_type::now() - start);
+    metrics_.resolved(found);
+    
+    if (found)
+    {
+        LOG_DEBUG("room {} found", key_);
+        res_.host = room_.host;
+    }
+    else
+    {
+        LOG_DEBUG("room {} created", key_);
+        res_.host = boost::none;
+        hosted_.emplace_back(key_, room_.host_id);
+    }
+    
+    res_.host_id = room_.host_id;
+    return res_;
+}
+
+connect_batch_res server_session::lookup(const connect_batch_req& batch)
+{
+    rooms_.find_or_insert(batch.rooms, room_entry{batch.from, batch.host, {}}, lookups_);
+    
+    metrics_.batch();
+    
+    connect_batch_res res {0, {}};
+    res.rooms.reserve(lookups_.size());
+    for (std::size_t i = 0; i < lookups_.size(); ++i)
+    {
+        auto& room = lookups_[i];
+        res.rooms.push_back(room_host{batch.rooms[i], room.entry.host_id, boost::none});
+        metrics_.resolved(room.found);
+        
+        if (room.found)
+        {
+            res.rooms.back().host = room.entry.host;
+        }
+        else
+        {
+            hosted_.emplace_back(batch.rooms[i], batch.from);
+        }
+    }
+    
+    LOG_DEBUG("batch of {} rooms resolved", batch.rooms.size());
+    return res;
+}
+
+bool server_session::renew(const heartbeat& hb)
+{
+    // a host may also heartbeat over a fresh connection,
+    // e.g. after the directory restarted
+    if (rooms_.refresh(hb.room, room_entry{hb.from, hb.host, {}}))
+    {
+        auto owned = std::make_pair(hb.room, hb.from);
+        if (std::find(hosted_.begin(), hosted_.end(), owned) == hosted_.end())
+        {
+            hosted_.push_back(std::move(owned));
+        }
+    }
+    
+    return true;
+}
+
+bool server_session::succession(const standby& sb)
+{
+    // ignored unless the sender hosts the room
+    rooms_.set_successors(sb.room, sb.from, sb.successors);
+    return true;
+}
 
-            if (ec != boost::asio::error::operation_aborted)
+void server_session::close()
+{
+    // the rooms stay up on their standbys, if they have any
+    for (auto& room: hosted_)
+    {
+        rooms_.release(room.first, room.second);
+    }
+    
+    hosted_.clear();
+    socket_.close();
+}
+
+void server_session::do_write()
+{
+    boost::asio::async_write(socket_, boost::asio::buffer(out_), make_alloc_handler(io_memory_,
+        [this, self = shared_from_this()](boost::system::error_code ec, std::size_t)
+        {
+            if (ec)
             {
+                close();
+                return;
             }
-        });
+            
+            out_.clear();
+            do_read();
+        }));
 }
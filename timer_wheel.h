@@ -0,0 +1,126 @@
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstdint>
+
+// Intrusive link embedded in whatever owns the timer.
+struct timer_hook
+{
+    timer_hook* prev{nullptr};
+    timer_hook* next{nullptr};
+    std::uint64_t expiry{0};
+    
+    bool armed() const { return prev != nullptr; }
+};
+
+// Hierarchical timing wheel: four levels of 64 slots covering 2^24 ticks.
+// Arming and cancelling are O(1); a tick only touches the due slot, plus one
+// higher-level slot that is cascaded down every time a lower level wraps.
+class timer_wheel
+{
+public:
+    static constexpr int slot_bits = 6;
+    static constexpr int slots = 1 << slot_bits;
+    static constexpr int levels = 4;
+    static constexpr std::uint64_t max_delay = (std::uint64_t(1) << (slot_bits * levels)) - 1;
+    
+    timer_wheel()
+    {
+        for (auto& level: wheel_)
+        {
+            for (auto& head: level)
+            {
+                head.prev = head.next = &head;
+            }
+        }
+    }
+    
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+    
+    std::uint64_t now() const { return now_; }
+    
+    // Expires `delay` ticks from now, at least one.
+    void arm(timer_hook& t, std::uint64_t delay)
+    {
+        cancel(t);
+        
+        if (delay < 1) delay = 1;
+        if (delay > max_delay) delay = max_delay;
+        
+        t.expiry = now_ + delay;
+        insert(t);
+    }
+    
+    void cancel(timer_hook& t)
+    {
+        if (t.armed())
+        {
+            t.prev->next = t.next;
+            t.next->prev = t.prev;
+            t.prev = t.next = nullptr;
+        }
+    }
+    
+    // Moves time forward by one tick and calls `expired(hook)` for every
+    // timer that became due. Hooks are unlinked before the call, so the
+    // callback may destroy or re-arm them.
+    template <typename F>
+    void advance(F expired)
+    {
+        auto tick = ++now_;
+        
+        // timers due before the next wrap of a level move down a level
+        for (int level = 1; level < levels; ++level)
+        {
+            if ((tick >> (slot_bits * (level - 1))) & (slots - 1))
+            {
+                break;
+            }
+            
+            cascade(wheel_[level][(tick >> (slot_bits * level)) & (slots - 1)]);
+        }
+        
+        auto& head = wheel_[0][tick & (slots - 1)];
+        while (head.next != &head)
+        {
+            auto& t = *head.next;
+            cancel(t);
+            expired(t);
+        }
+    }
+    
+private:
+    void insert(timer_hook& t)
+    {
+        auto delta = t.expiry - now_;
+        
+        int level = 0;
+        while (level + 1 < levels && delta >= (std::uint64_t(1) << (slot_bits * (level + 1))))
+        {
+            ++level;
+        }
+        
+        auto& head = wheel_[level][(t.expiry >> (slot_bits * level)) & (slots - 1)];
+        t.next = &head;
+        t.prev = head.prev;
+        head.prev->next = &t;
+        head.prev = &t;
+    }
+    
+    void cascade(timer_hook& head)
+    {
+        while (head.next != &head)
+        {
+            auto& t = *head.next;
+            cancel(t);
+            insert(t);
+        }
+    }
+    
+    timer_hook wheel_[levels][slots];
+    std::uint64_t now_{0};
+};
+
+#endif